@@ -0,0 +1,98 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <sys/time.h>
+#include <time.h>
+#include "benchmark.h"
+
+static const char *_phasesNames[] = {
+	"sceneAnimations",
+	"playerUpdate",
+	"redrawScene",
+	"addObjectsToScene",
+	"runObject",
+	"collisions",
+	"total"
+};
+
+const char *getTickPhaseName(int phase) {
+	return _phasesNames[phase];
+}
+
+uint64_t getTimeMicros() {
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return ts.tv_sec * (uint64_t)1000000 + ts.tv_nsec / 1000;
+	}
+#endif
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec * (uint64_t)1000000 + tv.tv_usec;
+}
+
+TickStats::TickStats()
+	: _count(0), _size(0) {
+	memset(_samples, 0, sizeof(_samples));
+	memset(_current, 0, sizeof(_current));
+}
+
+TickStats::~TickStats() {
+	for (int i = 0; i < kTickPhasesCount; ++i) {
+		free(_samples[i]);
+	}
+}
+
+void TickStats::beginTick() {
+	memset(_current, 0, sizeof(_current));
+}
+
+void TickStats::endTick() {
+	if (_count == _size) {
+		const int size = _size + 1024;
+		for (int i = 0; i < kTickPhasesCount; ++i) {
+			uint32_t *p = (uint32_t *)realloc(_samples[i], size * sizeof(uint32_t));
+			if (!p) {
+				return;
+			}
+			_samples[i] = p;
+		}
+		_size = size;
+	}
+	for (int i = 0; i < kTickPhasesCount; ++i) {
+		_samples[i][_count] = _current[i];
+	}
+	++_count;
+}
+
+static int compareSamples(const void *a, const void *b) {
+	const uint32_t s1 = *(const uint32_t *)a;
+	const uint32_t s2 = *(const uint32_t *)b;
+	return (s1 < s2) ? -1 : (s1 > s2);
+}
+
+void TickStats::dumpJson(FILE *fp) {
+	fprintf(fp, "{\n\t\"ticks\": %d,\n\t\"unit\": \"us\",\n\t\"phases\": {\n", _count);
+	for (int i = 0; i < kTickPhasesCount; ++i) {
+		uint32_t minValue = 0, maxValue = 0, p50 = 0, p99 = 0;
+		double mean = 0.;
+		if (_count != 0) {
+			qsort(_samples[i], _count, sizeof(uint32_t), compareSamples);
+			uint64_t sum = 0;
+			for (int j = 0; j < _count; ++j) {
+				sum += _samples[i][j];
+			}
+			minValue = _samples[i][0];
+			maxValue = _samples[i][_count - 1];
+			p50 = _samples[i][(_count - 1) * 50 / 100];
+			p99 = _samples[i][(_count - 1) * 99 / 100];
+			mean = sum / (double)_count;
+		}
+		fprintf(fp, "\t\t\"%s\": { \"min\": %u, \"mean\": %.1f, \"p50\": %u, \"p99\": %u, \"max\": %u }%s\n", _phasesNames[i], minValue, mean, p50, p99, maxValue, (i < kTickPhasesCount - 1) ? "," : "");
+	}
+	fprintf(fp, "\t}\n}\n");
+	// samples are sorted, no more ticks can be added
+	_count = 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef BENCHMARK_H__
+#define BENCHMARK_H__
+
+#include "util.h"
+#include "trace.h"
+
+enum {
+	kTickPhase_SceneAnimations,
+	kTickPhase_PlayerUpdate,
+	kTickPhase_RedrawScene,
+	kTickPhase_AddObjectsToScene,
+	kTickPhase_RunObject,
+	kTickPhase_Collisions,
+	kTickPhase_Total,
+	kTickPhasesCount
+};
+
+uint64_t getTimeMicros();
+const char *getTickPhaseName(int phase);
+
+struct TickStats {
+	uint32_t *_samples[kTickPhasesCount]; // microseconds
+	uint32_t _current[kTickPhasesCount];
+	int _count, _size;
+
+	TickStats();
+	~TickStats();
+
+	void beginTick();
+	void endTick();
+	void addTime(int phase, uint32_t us) { _current[phase] += us; }
+	void dumpJson(FILE *fp);
+};
+
+struct TickPhase {
+	TickStats *_stats;
+	int _phase;
+	uint64_t _start;
+	TraceZone _zone;
+
+	TickPhase(TickStats *stats, int phase)
+		: _stats(stats), _phase(phase), _start(stats ? getTimeMicros() : 0), _zone(getTickPhaseName(phase)) {
+	}
+	~TickPhase() {
+		if (_stats) {
+			_stats->addTime(_phase, (uint32_t)(getTimeMicros() - _start));
+		}
+	}
+};
+
+#endif // BENCHMARK_H__
@@ -5,8 +5,86 @@
 
 #include "game.h"
 
+void Game::initCollisionSlotsPool(int objectsCount) {
+	freeCollisionSlotsPool();
+	_colSlotsChunkSize = MAX(objectsCount, 64) * kColSlotsPerObject;
+}
+
+void Game::freeCollisionSlotsPool() {
+	if (_colSlotsChunksCount != 0) {
+		debug(kDebug_GAME, "Game::freeCollisionSlotsPool() used %d high water %d chunks %d size %d", _colSlotsUsed, _colSlotsHighWater, _colSlotsChunksCount, _colSlotsChunkSize);
+	}
+	for (int i = 0; i < _colSlotsChunksCount; ++i) {
+		free(_colSlotsChunks[i]);
+		_colSlotsChunks[i] = 0;
+	}
+	_colSlotsChunksCount = 0;
+	_colSlotsFreeList = 0;
+	_colSlotsUsed = _colSlotsHighWater = 0;
+}
+
+void Game::resetCollisionSlotsPool() {
+	// detach all the slots from the cells and the objects, the chunks are kept
+	for (int x = 0; x < kMapSizeX; ++x) {
+		for (int z = 0; z < kMapSizeZ; ++z) {
+			_sceneCellMap[x][z].colSlot = 0;
+		}
+	}
+	for (int i = 0; i < ARRAYSIZE(_objectKeysTable); ++i) {
+		if (_objectKeysTable[i]) {
+			_objectKeysTable[i]->colSlot = 0;
+		}
+	}
+	_colSlotsFreeList = 0;
+	for (int i = _colSlotsChunksCount - 1; i >= 0; --i) {
+		CollisionSlot *chunk = _colSlotsChunks[i];
+		for (int j = _colSlotsChunkSize - 1; j >= 0; --j) {
+			chunk[j].next = _colSlotsFreeList;
+			_colSlotsFreeList = &chunk[j];
+		}
+	}
+	_colSlotsUsed = 0;
+}
+
+CollisionSlot *Game::allocCollisionSlot() {
+	if (!_colSlotsFreeList) {
+		// the first chunk is allocated on the first use, more are only needed if the level objects use large boxes
+		if (_colSlotsChunksCount == kColSlotsChunksCount) {
+			error("Game::allocCollisionSlot() no free slot, used %d", _colSlotsUsed);
+		}
+		if (_colSlotsChunkSize == 0) {
+			_colSlotsChunkSize = 64 * kColSlotsPerObject;
+		}
+		CollisionSlot *chunk = ALLOC<CollisionSlot>(_colSlotsChunkSize);
+		if (!chunk) {
+			return 0;
+		}
+		if (_colSlotsChunksCount != 0) {
+			warning("Game::allocCollisionSlot() growing pool, used %d", _colSlotsUsed);
+		}
+		_colSlotsChunks[_colSlotsChunksCount++] = chunk;
+		for (int i = _colSlotsChunkSize - 1; i >= 0; --i) {
+			chunk[i].next = _colSlotsFreeList;
+			_colSlotsFreeList = &chunk[i];
+		}
+	}
+	CollisionSlot *colSlot = _colSlotsFreeList;
+	_colSlotsFreeList = colSlot->next;
+	++_colSlotsUsed;
+	if (_colSlotsUsed > _colSlotsHighWater) {
+		_colSlotsHighWater = _colSlotsUsed;
+	}
+	return colSlot;
+}
+
+void Game::freeCollisionSlot(CollisionSlot *colSlot) {
+	colSlot->next = _colSlotsFreeList;
+	_colSlotsFreeList = colSlot;
+	--_colSlotsUsed;
+}
+
 CollisionSlot *Game::createCollisionSlot(CollisionSlot *prev, CollisionSlot *next, GameObject *o, CellMap *cell) {
-	CollisionSlot *colSlot = (CollisionSlot *)malloc(sizeof(CollisionSlot));
+	CollisionSlot *colSlot = allocCollisionSlot();
 	if (colSlot) {
 		colSlot->o = o;
 		colSlot->prev = prev;
@@ -36,7 +114,7 @@ void Game::destroyCollisionSlot(CellMap *cell) {
 				}
 			}
 			CollisionSlot *next = colSlot->next;
-			free(colSlot);
+			freeCollisionSlot(colSlot);
 			_currentObject->colSlot = 0;
 			colSlot = next;
 		} else {
@@ -147,7 +225,7 @@ void Game::resetCollisionSlot(GameObject *o) {
 			}
 		}
 		CollisionSlot *next = colSlot->list;
-		free(colSlot);
+		freeCollisionSlot(colSlot);
 		colSlot = next;
 	}
 	o->colSlot = 0;
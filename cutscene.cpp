@@ -3,9 +3,113 @@
  * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include <SDL.h>
 #include "cutscene.h"
 #include "file.h"
 
+CutsceneFrameQueue::CutsceneFrameQueue()
+	: _thread(0), _mutex(0), _cond(0), _proc(0), _userdata(0), _framesCount(0), _readSlot(0), _writeSlot(0), _readyCount(0), _end(false), _quit(false) {
+}
+
+CutsceneFrameQueue::~CutsceneFrameQueue() {
+	stop();
+}
+
+void CutsceneFrameQueue::start(int framesCount, DecodeProc proc, void *userdata) {
+	stop();
+	_proc = proc;
+	_userdata = userdata;
+	_framesCount = 0;
+	_readSlot = _writeSlot = 0;
+	_readyCount = 0;
+	_end = _quit = false;
+	if (framesCount > 0) {
+		_mutex = SDL_CreateMutex();
+		_cond = SDL_CreateCond();
+		if (_mutex && _cond) {
+			_framesCount = MIN(framesCount, (int)kCutsceneDecodeFramesMax);
+			_thread = SDL_CreateThread(decodeThread, "cutsceneDecode", this);
+		}
+		if (!_thread) {
+			warning("CutsceneFrameQueue::start() unable to create the decoding thread");
+			_framesCount = 0;
+		}
+	}
+}
+
+void CutsceneFrameQueue::stop() {
+	if (_thread) {
+		SDL_LockMutex(_mutex);
+		_quit = true;
+		SDL_CondBroadcast(_cond);
+		SDL_UnlockMutex(_mutex);
+		SDL_WaitThread(_thread, 0);
+		_thread = 0;
+	}
+	if (_cond) {
+		SDL_DestroyCond(_cond);
+		_cond = 0;
+	}
+	if (_mutex) {
+		SDL_DestroyMutex(_mutex);
+		_mutex = 0;
+	}
+	_framesCount = 0;
+}
+
+int CutsceneFrameQueue::getFrame() {
+	if (_framesCount == 0) {
+		if (!_end && !_proc(_userdata, 0)) {
+			_end = true;
+		}
+		return _end ? -1 : 0;
+	}
+	SDL_LockMutex(_mutex);
+	while (_readyCount == 0 && !_end) {
+		SDL_CondWait(_cond, _mutex);
+	}
+	const int slot = (_readyCount != 0) ? _readSlot : -1;
+	SDL_UnlockMutex(_mutex);
+	return slot;
+}
+
+void CutsceneFrameQueue::releaseFrame() {
+	if (_framesCount == 0) {
+		return;
+	}
+	SDL_LockMutex(_mutex);
+	_readSlot = (_readSlot + 1) % _framesCount;
+	--_readyCount;
+	SDL_CondBroadcast(_cond);
+	SDL_UnlockMutex(_mutex);
+}
+
+int CutsceneFrameQueue::decodeThread(void *userdata) {
+	CutsceneFrameQueue *q = (CutsceneFrameQueue *)userdata;
+	SDL_LockMutex(q->_mutex);
+	while (!q->_quit) {
+		if (q->_readyCount == q->_framesCount) {
+			SDL_CondWait(q->_cond, q->_mutex);
+			continue;
+		}
+		// the slot is not visible to the reader until _readyCount is incremented
+		const int slot = q->_writeSlot;
+		SDL_UnlockMutex(q->_mutex);
+		const bool ret = q->_proc(q->_userdata, slot);
+		SDL_LockMutex(q->_mutex);
+		if (!ret) {
+			q->_end = true;
+			SDL_CondBroadcast(q->_cond);
+			break;
+		}
+		q->_writeSlot = (slot + 1) % q->_framesCount;
+		++q->_readyCount;
+		SDL_CondBroadcast(q->_cond);
+	}
+	SDL_UnlockMutex(q->_mutex);
+	return 0;
+}
+
 Cutscene::Cutscene(Render *render, Game *g, Sound *snd) {
 	_playCounter = 0;
 	memset(_playedTable, 0, sizeof(_playedTable));
@@ -12,11 +12,40 @@
 enum {
 	kCutsceneScenesCount = 54,
 	kCutscenePlaybackQueueSize = 4,
+	kCutsceneDecodeFramesMax = 8,
 };
 
 struct Game;
 struct Sound;
 struct Render;
+struct SDL_Thread;
+struct SDL_mutex;
+struct SDL_cond;
+
+// ring of frames decoded ahead by a background thread
+struct CutsceneFrameQueue {
+	typedef bool (*DecodeProc)(void *userdata, int slot); // returns false at the end of the stream
+
+	SDL_Thread *_thread;
+	SDL_mutex *_mutex;
+	SDL_cond *_cond;
+	DecodeProc _proc;
+	void *_userdata;
+	int _framesCount;
+	int _readSlot, _writeSlot;
+	int _readyCount;
+	bool _end, _quit;
+
+	CutsceneFrameQueue();
+	~CutsceneFrameQueue();
+
+	// framesCount 0 decodes each frame on the calling thread when requested
+	void start(int framesCount, DecodeProc proc, void *userdata);
+	void stop();
+	int getFrame(); // slot of the next frame, -1 at the end of the stream
+	void releaseFrame();
+	static int decodeThread(void *userdata);
+};
 
 struct CutscenePlayer {
 	Render *_render;
@@ -33,6 +62,8 @@ struct CutscenePlayer {
 CutscenePlayer *CutscenePlayer_Dps_create();
 CutscenePlayer *CutscenePlayer_Cin_create();
 
+void benchmarkMdec(const char *filePath);
+
 struct Cutscene {
 	CutscenePlayer *_player;
 
@@ -8,6 +8,7 @@
 #include "game.h"
 #include "file.h"
 #include "sound.h"
+#include "trace.h"
 #include "render.h"
 
 enum {
@@ -38,6 +39,13 @@ struct CinFrameHeader {
 	uint32_t mark; /* 0xAA55AA55 */
 };
 
+struct CinFrame {
+	uint8_t *pixels;
+	uint8_t palette[256 * 3];
+	uint8_t *soundData;
+	int soundSize;
+};
+
 struct CutscenePlayer_Cin: CutscenePlayer {
 
 	File *_fp;
@@ -48,7 +56,10 @@ struct CutscenePlayer_Cin: CutscenePlayer {
 	uint8_t *_frameReadBuffer;
 	int _frameCounter;
 	int _duration;
-	uint8_t *_soundReadBuffer;
+	// the file, _frameHdr, _frameBuffers[1,2] and _decodePalette are owned by the decoding thread
+	uint8_t _decodePalette[256 * 3];
+	CinFrame _frames[kCutsceneDecodeFramesMax];
+	CutsceneFrameQueue _queue;
 	struct {
 		const char *data;
 		int duration;
@@ -65,7 +76,9 @@ struct CutscenePlayer_Cin: CutscenePlayer {
 	bool readFrameHeader(CinFrameHeader *hdr);
 	void setPaletteColor(int index, uint8_t r, uint8_t g, uint8_t b);
 	void updatePalette(int palType, int colorsCount, const uint8_t *p);
-	void decodeImage(const uint8_t *frameData);
+	void decodeImage(const uint8_t *frameData, uint8_t *dst);
+	bool decodeFrame(CinFrame *frame);
+	static bool decodeFrameProc(void *userdata, int slot);
 	void updateMessages();
 
 	virtual bool load(int num);
@@ -76,6 +89,11 @@ struct CutscenePlayer_Cin: CutscenePlayer {
 };
 
 CutscenePlayer_Cin::CutscenePlayer_Cin() {
+	_fp = 0;
+	memset(_palette, 0, sizeof(_palette));
+	memset(_frameBuffers, 0, sizeof(_frameBuffers));
+	_frameReadBuffer = 0;
+	memset(_frames, 0, sizeof(_frames));
 	_updateTicks = 0;
 	_frameTicks = 0;
 }
@@ -107,7 +125,7 @@ bool CutscenePlayer_Cin::readFrameHeader(CinFrameHeader *hdr) {
 
 void CutscenePlayer_Cin::setPaletteColor(int index, uint8_t r, uint8_t g, uint8_t b) {
 	assert(index >= 0 && index < 256);
-	uint8_t *p = &_palette[index * 3];
+	uint8_t *p = &_decodePalette[index * 3];
 	*p++ = r;
 	*p++ = g;
 	*p++ = b;
@@ -179,42 +197,78 @@ static void decodeADD(const uint8_t *src, int srcSize, uint8_t *dst) {
 	}
 }
 
-void CutscenePlayer_Cin::decodeImage(const uint8_t *frameData) {
+// _frameBuffers[1] holds the previous frame, _frameBuffers[2] is used for the huffman decoding
+void CutscenePlayer_Cin::decodeImage(const uint8_t *frameData, uint8_t *dst) {
 	int frameSize;
-	if (_frameHdr.videoFrameType != 1) {
-		switch (_frameHdr.videoFrameType) {
-		case 9:
-			decodeRLE(frameData, _frameHdr.videoFrameSize, _frameBuffers[0]);
-			break;
-		case 34:
-			decodeRLE(frameData, _frameHdr.videoFrameSize, _frameBuffers[0]);
-			decodeADD(_frameBuffers[1], _fileHdr.videoFrameSize, _frameBuffers[0]);
-			break;
-		case 35:
-			decodeHuffman(frameData, _frameHdr.videoFrameSize, _frameBuffers[2]);
-			decodeRLE(_frameBuffers[2], _frameHdr.videoFrameSize, _frameBuffers[0]);
-			break;
-		case 36:
-			frameSize = decodeHuffman(frameData, _frameHdr.videoFrameSize, _frameBuffers[2]);
-			decodeRLE(_frameBuffers[2], frameSize, _frameBuffers[0]);
-			decodeADD(_frameBuffers[1], _fileHdr.videoFrameSize, _frameBuffers[0]);
-			break;
-		case 37:
-			decodeHuffman(frameData, _frameHdr.videoFrameSize, _frameBuffers[0]);
-			break;
-		case 38:
-			decodeLZSS(frameData, _frameBuffers[0], _fileHdr.videoFrameSize);
-			break;
-		case 39:
-			decodeLZSS(frameData, _frameBuffers[0], _fileHdr.videoFrameSize);
-			decodeADD(_frameBuffers[1], _fileHdr.videoFrameSize, _frameBuffers[0]);
-			break;
-		default:
-			warning("CutscenePlayer_Cin::decodeImage() Unhandled video frame type 0x%X", _frameHdr.videoFrameType);
-			break;
+	switch (_frameHdr.videoFrameType) {
+	case 1:
+		memcpy(dst, _frameBuffers[1], _fileHdr.videoFrameSize);
+		break;
+	case 9:
+		decodeRLE(frameData, _frameHdr.videoFrameSize, dst);
+		break;
+	case 34:
+		decodeRLE(frameData, _frameHdr.videoFrameSize, dst);
+		decodeADD(_frameBuffers[1], _fileHdr.videoFrameSize, dst);
+		break;
+	case 35:
+		decodeHuffman(frameData, _frameHdr.videoFrameSize, _frameBuffers[2]);
+		decodeRLE(_frameBuffers[2], _frameHdr.videoFrameSize, dst);
+		break;
+	case 36:
+		frameSize = decodeHuffman(frameData, _frameHdr.videoFrameSize, _frameBuffers[2]);
+		decodeRLE(_frameBuffers[2], frameSize, dst);
+		decodeADD(_frameBuffers[1], _fileHdr.videoFrameSize, dst);
+		break;
+	case 37:
+		decodeHuffman(frameData, _frameHdr.videoFrameSize, dst);
+		break;
+	case 38:
+		decodeLZSS(frameData, dst, _fileHdr.videoFrameSize);
+		break;
+	case 39:
+		decodeLZSS(frameData, dst, _fileHdr.videoFrameSize);
+		decodeADD(_frameBuffers[1], _fileHdr.videoFrameSize, dst);
+		break;
+	default:
+		warning("CutscenePlayer_Cin::decodeImage() Unhandled video frame type 0x%X", _frameHdr.videoFrameType);
+		memcpy(dst, _frameBuffers[1], _fileHdr.videoFrameSize);
+		break;
+	}
+	memcpy(_frameBuffers[1], dst, _fileHdr.videoFrameSize);
+}
+
+bool CutscenePlayer_Cin::decodeFrame(CinFrame *frame) {
+	TraceZone zone("CutscenePlayer_Cin::decodeFrame");
+	if (!readFrameHeader(&_frameHdr)) {
+		return false;
+	}
+	int palType = 0;
+	if (_frameHdr.palColorsCount < 0) {
+		_frameHdr.palColorsCount = -_frameHdr.palColorsCount;
+		palType = 1;
+	}
+	const int palSize = (palType + 3) * _frameHdr.palColorsCount;
+	assert(palSize + _frameHdr.videoFrameSize < _fileHdr.videoFrameSize + 1024);
+	fileRead(_fp, _frameReadBuffer, palSize + _frameHdr.videoFrameSize);
+	frame->soundSize = 0;
+	if (!g_isDemo && _frameHdr.soundFrameSize != 0) {
+		uint8_t *p = (uint8_t *)realloc(frame->soundData, _frameHdr.soundFrameSize);
+		if (p) {
+			frame->soundData = p;
+			frame->soundSize = _frameHdr.soundFrameSize;
+			fileRead(_fp, frame->soundData, frame->soundSize);
 		}
 	}
-	memcpy(_frameBuffers[1], _frameBuffers[0], _fileHdr.videoFrameSize);
+	updatePalette(palType, _frameHdr.palColorsCount, _frameReadBuffer);
+	memcpy(frame->palette, _decodePalette, sizeof(_decodePalette));
+	decodeImage(_frameReadBuffer + palSize, frame->pixels);
+	return true;
+}
+
+bool CutscenePlayer_Cin::decodeFrameProc(void *userdata, int slot) {
+	CutscenePlayer_Cin *cut = (CutscenePlayer_Cin *)userdata;
+	return cut->decodeFrame(&cut->_frames[slot]);
 }
 
 static int _drawSubCharRectHeight;
@@ -407,6 +461,7 @@ static const struct {
 
 bool CutscenePlayer_Cin::load(int num) {
 	debug(kDebug_CUTSCENE, "CutscenePlayer_Cin::load() num %d", num);
+	memcpy(_decodePalette, _palette, sizeof(_palette));
 	if (num == 44) {
 		setPaletteColor(1, 255, 255, 255);
 	}
@@ -459,24 +514,36 @@ bool CutscenePlayer_Cin::load(int num) {
 		_frameBuffers[i] = (uint8_t *)malloc(_fileHdr.videoFrameSize);
 	}
 	_frameReadBuffer = (uint8_t *)malloc(_fileHdr.videoFrameSize + 1024);
-	_soundReadBuffer = 0;
+	memset(_frameBuffers[1], 0, _fileHdr.videoFrameSize);
+	const int decodeAhead = CLIP(_game->_params.cutsceneDecodeAhead, 0, (int)kCutsceneDecodeFramesMax);
+	for (int i = 0; i < MAX(decodeAhead, 1); ++i) {
+		_frames[i].pixels = (uint8_t *)malloc(_fileHdr.videoFrameSize);
+		_frames[i].soundData = 0;
+		_frames[i].soundSize = 0;
+	}
 	_snd->_mix.playQueue(4, kMixerQueueType_D16);
 	_frameCounter = 0;
 	_msgsCount = 0;
 	memset(&_msgs, 0, sizeof(_msgs));
 	_frameTicks = 0;
+	_queue.start(decodeAhead, decodeFrameProc, this);
 	return true;
 }
 
 void CutscenePlayer_Cin::unload() {
+	_queue.stop();
 	for (int i = 0; i < kFrameBuffersCount; ++i) {
 		free(_frameBuffers[i]);
 		_frameBuffers[i] = 0;
 	}
 	free(_frameReadBuffer);
 	_frameReadBuffer = 0;
-	free(_soundReadBuffer);
-	_soundReadBuffer = 0;
+	for (int i = 0; i < kCutsceneDecodeFramesMax; ++i) {
+		free(_frames[i].pixels);
+		_frames[i].pixels = 0;
+		free(_frames[i].soundData);
+		_frames[i].soundData = 0;
+	}
 	if (_fp) {
 		fileClose(_fp);
 		_fp = 0;
@@ -493,26 +560,18 @@ bool CutscenePlayer_Cin::play() {
 		_frameCounter = 1;
 	}
 	if (!g_isDemo || _frameCounter == 1) {
-		if (!readFrameHeader(&_frameHdr)) {
+		const int slot = _queue.getFrame();
+		if (slot < 0) {
 			return false;
 		}
-		int palType = 0;
-		if (_frameHdr.palColorsCount < 0) {
-			_frameHdr.palColorsCount = -_frameHdr.palColorsCount;
-			palType = 1;
-		}
-		const int palSize = (palType + 3) * _frameHdr.palColorsCount;
-		assert(palSize + _frameHdr.videoFrameSize < _fileHdr.videoFrameSize + 1024);
-		fileRead(_fp, _frameReadBuffer, palSize + _frameHdr.videoFrameSize);
-		if (!g_isDemo && _frameHdr.soundFrameSize != 0) {
-			_soundReadBuffer = (uint8_t *)realloc(_soundReadBuffer, _frameHdr.soundFrameSize);
-			if (_soundReadBuffer) {
-				fileRead(_fp, _soundReadBuffer, _frameHdr.soundFrameSize);
-				_snd->_mix.appendToQueue(_soundReadBuffer, _frameHdr.soundFrameSize);
-			}
+		// the sound is queued when the frame is displayed to keep the audio in sync
+		const CinFrame *frame = &_frames[slot];
+		memcpy(_palette, frame->palette, sizeof(_palette));
+		memcpy(_frameBuffers[0], frame->pixels, _fileHdr.videoFrameSize);
+		if (frame->soundSize != 0) {
+			_snd->_mix.appendToQueue(frame->soundData, frame->soundSize);
 		}
-		updatePalette(palType, _frameHdr.palColorsCount, _frameReadBuffer);
-		decodeImage(_frameReadBuffer + palSize);
+		_queue.releaseFrame();
 		updateMessages();
 	}
 	drawFrame();
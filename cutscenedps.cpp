@@ -1,9 +1,12 @@
 
 #include <math.h>
 #include "cutscene.h"
+#include "game.h"
 #include "render.h"
 #include "sound.h"
 #include "mdec.h"
+#include "trace.h"
+#include "benchmark.h"
 
 enum {
 	kSectorSize = 2352,
@@ -23,6 +26,15 @@ struct DpsHeader {
 	uint8_t xaBits;
 };
 
+struct DpsFrame {
+	uint8_t *rgbaBuffer;
+	bool hasVideo;
+	bool playAudio; // first audio sector
+	uint8_t *audioData;
+	int audioSectorsCount;
+	int audioSectorsSize;
+};
+
 struct CutscenePlayer_Dps: CutscenePlayer {
 
 	File *_fp;
@@ -30,12 +42,18 @@ struct CutscenePlayer_Dps: CutscenePlayer {
 	DpsHeader _header;
 	int _frameCounter;
 	int _sectorCounter;
-	uint8_t *_rgbaBuffer;
+	// the file, _sector and _header.xa* fields are owned by the decoding thread
+	uint8_t *_rgbaBuffer; // output of outputMdecCb
+	DpsFrame _frames[kCutsceneDecodeFramesMax];
+	CutsceneFrameQueue _queue;
 
 	CutscenePlayer_Dps();
 	virtual ~CutscenePlayer_Dps();
 
 	bool readSector();
+	void freeFrames();
+	bool decodeFrame(DpsFrame *frame);
+	static bool decodeFrameProc(void *userdata, int slot);
 	bool play();
 	bool readHeader(DpsHeader *header);
 	virtual bool load(int num);
@@ -45,10 +63,23 @@ struct CutscenePlayer_Dps: CutscenePlayer {
 
 CutscenePlayer_Dps::CutscenePlayer_Dps()
 	: _fp(0), _rgbaBuffer(0) {
+	memset(_frames, 0, sizeof(_frames));
 }
 
 CutscenePlayer_Dps::~CutscenePlayer_Dps() {
-	free(_rgbaBuffer);
+	freeFrames();
+}
+
+void CutscenePlayer_Dps::freeFrames() {
+	_queue.stop();
+	for (int i = 0; i < kCutsceneDecodeFramesMax; ++i) {
+		free(_frames[i].rgbaBuffer);
+		_frames[i].rgbaBuffer = 0;
+		free(_frames[i].audioData);
+		_frames[i].audioData = 0;
+		_frames[i].audioSectorsSize = 0;
+	}
+	_rgbaBuffer = 0;
 }
 
 static const char *_namesTable[] = {
@@ -151,21 +182,14 @@ static uint32_t yuv420_to_rgba(int y, int u, int v) {
 static void outputMdecCb(const MdecOutput *output, void *userdata) {
 	CutscenePlayer_Dps *cut = (CutscenePlayer_Dps *)userdata;
 	uint32_t *dst = (uint32_t *)cut->_rgbaBuffer + (cut->_header.h - 1) * cut->_header.w;
-	const uint8_t *luma = output->planes[0].ptr;
-	const uint8_t *cb = output->planes[1].ptr;
-	const uint8_t *cr = output->planes[2].ptr;
-	for (int y = 0; y < output->h; ++y) {
-		for (int x = 0; x < output->w; ++x) {
-			dst[x] = yuv420_to_rgba(luma[x], cb[x / 2] - 128, cr[x / 2] - 128);
-		}
-		dst -= cut->_header.w;
-		luma += output->planes[0].pitch;
-		cb += output->planes[1].pitch * (y & 1);
-		cr += output->planes[2].pitch * (y & 1);
-	}
+	convertMdecToRgba(output, dst, -cut->_header.w, MIN<int>(output->w, cut->_header.w), MIN<int>(output->h, cut->_header.h));
 }
 
-bool CutscenePlayer_Dps::play() {
+bool CutscenePlayer_Dps::decodeFrame(DpsFrame *frame) {
+	TraceZone zone("CutscenePlayer_Dps::decodeFrame");
+	frame->hasVideo = false;
+	frame->playAudio = false;
+	frame->audioSectorsCount = 0;
 	bool err = false;
 	// demux audio and video frames
 	uint8_t *videoData = 0;
@@ -198,10 +222,9 @@ bool CutscenePlayer_Dps::play() {
 				}
 				memcpy(videoData + currentSector * kVideoDataSize, _sector + kVideoHeaderSize, kVideoDataSize);
 				if (currentSector == videoSectorsCount - 1) {
+					_rgbaBuffer = frame->rgbaBuffer;
 					decodeMDEC(videoData, videoSectorsCount * kVideoDataSize, _header.w, _header.h, this, outputMdecCb);
-					const int y = (kCutscenePsxVideoHeight - _header.h) / 2;
-					_render->copyToOverlay(0, y, _header.w, _header.h, _rgbaBuffer, true);
-					++_frameCounter;
+					frame->hasVideo = true;
 					free(videoData);
 					videoData = 0;
 				}
@@ -216,14 +239,53 @@ bool CutscenePlayer_Dps::play() {
 					err = true;
 					break;
 				}
-				_snd->_mix.playQueue(4, kMixerQueueType_XA);
+				frame->playAudio = true;
+			}
+			if (frame->audioSectorsCount == frame->audioSectorsSize) {
+				const int size = frame->audioSectorsSize + 8;
+				uint8_t *p = (uint8_t *)realloc(frame->audioData, size * kAudioDataSize);
+				if (!p) {
+					err = true;
+					break;
+				}
+				frame->audioData = p;
+				frame->audioSectorsSize = size;
 			}
-			_snd->_mix.appendToQueue(_sector + kAudioHeaderSize, kAudioDataSize);
+			memcpy(frame->audioData + frame->audioSectorsCount * kAudioDataSize, _sector + kAudioHeaderSize, kAudioDataSize);
+			++frame->audioSectorsCount;
 		}
 	} while (videoCurrentSector != videoSectorsCount - 1 && !fileEof(_fp) && !err);
+	free(videoData);
 	return !err;
 }
 
+bool CutscenePlayer_Dps::decodeFrameProc(void *userdata, int slot) {
+	CutscenePlayer_Dps *cut = (CutscenePlayer_Dps *)userdata;
+	return cut->decodeFrame(&cut->_frames[slot]);
+}
+
+bool CutscenePlayer_Dps::play() {
+	const int slot = _queue.getFrame();
+	if (slot < 0) {
+		return false;
+	}
+	// the audio sectors are queued when the frame is displayed, the mixer clocks the XA playback
+	const DpsFrame *frame = &_frames[slot];
+	if (frame->playAudio) {
+		_snd->_mix.playQueue(4, kMixerQueueType_XA);
+	}
+	for (int i = 0; i < frame->audioSectorsCount; ++i) {
+		_snd->_mix.appendToQueue(frame->audioData + i * kAudioDataSize, kAudioDataSize);
+	}
+	if (frame->hasVideo) {
+		const int y = (kCutscenePsxVideoHeight - _header.h) / 2;
+		_render->copyToOverlay(0, y, _header.w, _header.h, frame->rgbaBuffer, true);
+		++_frameCounter;
+	}
+	_queue.releaseFrame();
+	return true;
+}
+
 bool CutscenePlayer_Dps::readHeader(DpsHeader *hdr) {
 	if (!readSector()) {
 		warning("CutscenePlayer_Dps::readHeader() Invalid first sector");
@@ -275,19 +337,20 @@ bool CutscenePlayer_Dps::load(int num) {
 			fileClose(_fp);
 			_fp = 0;
 		} else {
-			_rgbaBuffer = (uint8_t *)malloc(_header.w * _header.h * sizeof(uint32_t));
+			const int decodeAhead = CLIP(_game->_params.cutsceneDecodeAhead, 0, (int)kCutsceneDecodeFramesMax);
+			for (int i = 0; i < MAX(decodeAhead, 1); ++i) {
+				_frames[i].rgbaBuffer = (uint8_t *)malloc(_header.w * _header.h * sizeof(uint32_t));
+			}
 			_render->clearScreen();
 			_render->resizeOverlay(_header.w, _header.h, true, kCutscenePsxVideoWidth, kCutscenePsxVideoHeight);
+			_queue.start(decodeAhead, decodeFrameProc, this);
 		}
 	}
 	return _fp != 0;
 }
 
 void CutscenePlayer_Dps::unload() {
-	if (_rgbaBuffer) {
-		free(_rgbaBuffer);
-		_rgbaBuffer = 0;
-	}
+	freeFrames();
 	if (_fp) {
 		fileClose(_fp);
 		_fp = 0;
@@ -305,3 +368,112 @@ bool CutscenePlayer_Dps::update(uint32_t ticks) {
 CutscenePlayer *CutscenePlayer_Dps_create() {
 	return new CutscenePlayer_Dps();
 }
+
+struct MdecBenchmarkOutput {
+	uint32_t *rgbaBuffer;
+	int w, h;
+};
+
+static void outputMdecReferenceCb(const MdecOutput *output, void *userdata) {
+	MdecBenchmarkOutput *out = (MdecBenchmarkOutput *)userdata;
+	uint32_t *dst = out->rgbaBuffer;
+	const uint8_t *luma = output->planes[0].ptr;
+	const uint8_t *cb = output->planes[1].ptr;
+	const uint8_t *cr = output->planes[2].ptr;
+	for (int y = 0; y < out->h; ++y) {
+		for (int x = 0; x < out->w; ++x) {
+			dst[x] = yuv420_to_rgba(luma[x], cb[x / 2] - 128, cr[x / 2] - 128);
+		}
+		dst += out->w;
+		luma += output->planes[0].pitch;
+		cb += output->planes[1].pitch * (y & 1);
+		cr += output->planes[2].pitch * (y & 1);
+	}
+}
+
+static void outputMdecBenchmarkCb(const MdecOutput *output, void *userdata) {
+	MdecBenchmarkOutput *out = (MdecBenchmarkOutput *)userdata;
+	convertMdecToRgba(output, out->rgbaBuffer, out->w, out->w, out->h);
+}
+
+void benchmarkMdec(const char *filePath) {
+	FILE *fp = fopen(filePath, "rb");
+	if (!fp) {
+		warning("Unable to open '%s'", filePath);
+		return;
+	}
+	static uint8_t sector[kSectorSize];
+	uint8_t *videoData = 0;
+	int videoDataSize = 0;
+	MdecBenchmarkOutput ref, out;
+	ref.rgbaBuffer = out.rgbaBuffer = 0;
+	int framesCount = 0;
+	int macroblocksCount = 0;
+	uint64_t refTime = 0, outTime = 0;
+	double squaredError = 0.;
+	int maxError = 0;
+	while (fread(sector, 1, sizeof(sector), fp) == sizeof(sector)) {
+		if (memcmp(sector, _cdSync, sizeof(_cdSync)) != 0) {
+			warning("Invalid sector in '%s'", filePath);
+			break;
+		}
+		if ((sector[0x12] & 0xE) != 2 || READ_LE_UINT32(sector + 0x18) != 0x80010160) {
+			continue;
+		}
+		const int currentSector = READ_LE_UINT16(sector + 0x1C);
+		const int sectorsCount = READ_LE_UINT16(sector + 0x1E);
+		if (currentSector >= sectorsCount || READ_LE_UINT32(sector + 0x24) == 0) {
+			continue;
+		}
+		if (sectorsCount * kVideoDataSize > videoDataSize) {
+			videoDataSize = sectorsCount * kVideoDataSize;
+			videoData = (uint8_t *)realloc(videoData, videoDataSize);
+		}
+		memcpy(videoData + currentSector * kVideoDataSize, sector + kVideoHeaderSize, kVideoDataSize);
+		if (currentSector != sectorsCount - 1) {
+			continue;
+		}
+		const int w = READ_LE_UINT16(sector + 0x28);
+		const int h = READ_LE_UINT16(sector + 0x2A);
+		if (!ref.rgbaBuffer) {
+			ref.w = out.w = w;
+			ref.h = out.h = h;
+			ref.rgbaBuffer = (uint32_t *)malloc(w * h * sizeof(uint32_t));
+			out.rgbaBuffer = (uint32_t *)malloc(w * h * sizeof(uint32_t));
+		} else if (w != ref.w || h != ref.h) {
+			continue;
+		}
+		uint64_t t = getTimeMicros();
+		decodeMDEC(videoData, sectorsCount * kVideoDataSize, w, h, &ref, outputMdecReferenceCb, true);
+		refTime += getTimeMicros() - t;
+		t = getTimeMicros();
+		decodeMDEC(videoData, sectorsCount * kVideoDataSize, w, h, &out, outputMdecBenchmarkCb);
+		outTime += getTimeMicros() - t;
+		for (int i = 0; i < w * h; ++i) {
+			for (int shift = 0; shift < 24; shift += 8) {
+				const int diff = ABS((int)((ref.rgbaBuffer[i] >> shift) & 255) - (int)((out.rgbaBuffer[i] >> shift) & 255));
+				squaredError += diff * diff;
+				maxError = MAX(maxError, diff);
+			}
+		}
+		++framesCount;
+		macroblocksCount += ((w + 15) / 16) * ((h + 15) / 16);
+	}
+	fclose(fp);
+	free(videoData);
+	free(ref.rgbaBuffer);
+	free(out.rgbaBuffer);
+	if (framesCount == 0) {
+		warning("No video frame found in '%s'", filePath);
+		return;
+	}
+	const double mse = squaredError / (framesCount * ref.w * ref.h * 3.);
+	printf("%d frames, %d macroblocks\n", framesCount, macroblocksCount);
+	printf("reference: %.1f macroblocks/s\n", refTime != 0 ? macroblocksCount * 1000000. / refTime : 0.);
+	printf("fixed point: %.1f macroblocks/s\n", outTime != 0 ? macroblocksCount * 1000000. / outTime : 0.);
+	if (mse == 0.) {
+		printf("bit exact\n");
+	} else {
+		printf("PSNR %.2f dB, max error %d\n", 10. * log10(255. * 255. / mse), maxError);
+	}
+}
@@ -3,10 +3,16 @@
  * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include <ctype.h>
 #include <dirent.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include <zlib.h>
+#include <SDL.h>
 #include "file.h"
 
 struct File {
@@ -20,6 +26,9 @@ struct File {
 	virtual int seek(int pos, int whence) = 0;
 	virtual int read(void *, int) = 0;
 	virtual int write(const void *, int) = 0;
+	virtual uint8_t *map(int size) {
+		return 0;
+	}
 };
 
 struct StdioFile: File {
@@ -74,81 +83,263 @@ struct StdioFile: File {
 		}
 		return 0;
 	}
+	virtual uint8_t *map(int size) {
+#ifndef _WIN32
+		if (_fp && size > 0) {
+			// private mapping, pages written to are copied
+			void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(_fp), 0);
+			if (p != MAP_FAILED) {
+				return (uint8_t *)p;
+			}
+		}
+#endif
+		return 0;
+	}
 };
 
-struct GzipFile: File {
-	gzFile _fp;
+struct GzipWriteJob {
+	gzFile fp;
+	uint8_t *buf;
+	int size;
+	char path[MAXPATHLEN];
+	char tmpPath[MAXPATHLEN];
+	bool failed; // cleared by fileWaitPendingWrites()
+};
 
+static GzipWriteJob _gzipWriteJob;
+static SDL_Thread *_gzipWriteThread;
+
+static int gzipWriteThread(void *data) {
+	GzipWriteJob *job = (GzipWriteJob *)data;
+	const int count = gzwrite(job->fp, job->buf, job->size);
+	bool ok = (gzclose(job->fp) == Z_OK && count == job->size);
+	free(job->buf);
+	job->buf = 0;
+	if (ok) {
+		// the previous file is only replaced once the new one is complete
+#ifdef _WIN32
+		remove(job->path);
+#endif
+		ok = (rename(job->tmpPath, job->path) == 0);
+	}
+	if (!ok) {
+		warning("I/O error on writing '%s'", job->path);
+		remove(job->tmpPath);
+		job->failed = true;
+		return -1;
+	}
+	return 0;
+}
+
+static void waitGzipWriteThread() {
+	if (_gzipWriteThread) {
+		SDL_WaitThread(_gzipWriteThread, 0);
+		_gzipWriteThread = 0;
+	}
+}
+
+// the whole file is decompressed on open, writes are buffered and compressed on a background thread on close
+struct BufferedGzipFile: File {
+	gzFile _fp;
+	char _path[MAXPATHLEN];
+	uint8_t *_buf;
+	int _size, _capacity;
+	int _pos;
+	bool _eof, _err;
+
+	BufferedGzipFile()
+		: _fp(0), _buf(0), _size(0), _capacity(0), _pos(0), _eof(false), _err(false) {
+		_path[0] = 0;
+	}
+	virtual ~BufferedGzipFile() {
+		free(_buf);
+	}
+	bool grow(int size) {
+		if (size > _capacity) {
+			const int capacity = MAX(size, MAX(_capacity * 2, 65536));
+			uint8_t *p = (uint8_t *)realloc(_buf, capacity);
+			if (!p) {
+				_err = true;
+				return false;
+			}
+			_buf = p;
+			_capacity = capacity;
+		}
+		return true;
+	}
 	virtual bool open(const char *path, const char *mode) {
-		_fp = gzopen(path, mode);
-		return _fp != 0;
+		if (mode[0] == 'w') {
+			// written to a temporary file, renamed on completion by the background thread
+			snprintf(_path, sizeof(_path), "%s", path);
+			char tmpPath[MAXPATHLEN];
+			snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+			_fp = gzopen(tmpPath, mode);
+			return _fp != 0;
+		}
+		gzFile fp = gzopen(path, mode);
+		if (!fp) {
+			return false;
+		}
+		int count;
+		while (grow(_size + 65536) && (count = gzread(fp, _buf + _size, _capacity - _size)) > 0) {
+			_size += count;
+		}
+		// a decompression error truncates the data, it is reported by err() as for the unbuffered files
+		int errnum;
+		gzerror(fp, &errnum);
+		if (errnum != Z_OK && errnum != Z_STREAM_END) {
+			_err = true;
+		}
+		gzclose(fp);
+		return true;
 	}
 	virtual void close() {
 		if (_fp) {
-			gzclose(_fp);
+			waitGzipWriteThread();
+			_gzipWriteJob.fp = _fp;
+			_gzipWriteJob.buf = _buf;
+			_gzipWriteJob.size = _size;
+			snprintf(_gzipWriteJob.path, sizeof(_gzipWriteJob.path), "%s", _path);
+			snprintf(_gzipWriteJob.tmpPath, sizeof(_gzipWriteJob.tmpPath), "%s.tmp", _path);
 			_fp = 0;
+			_buf = 0;
+			_gzipWriteThread = SDL_CreateThread(gzipWriteThread, "gzipWrite", &_gzipWriteJob);
+			if (!_gzipWriteThread) {
+				gzipWriteThread(&_gzipWriteJob);
+			}
 		}
 	}
 	virtual int eof() {
-		if (_fp) {
-			return gzeof(_fp);
-		}
-		return 0;
+		return _eof;
 	}
 	virtual int err() {
-		if (_fp) {
-			int errnum;
-			gzerror(_fp, &errnum);
-			return errnum != Z_OK;
-		}
-		return 0;
+		return _err;
 	}
 	virtual int tell() {
-		if (_fp) {
-			return gztell(_fp);
-		}
-		return 0;
+		return _pos;
 	}
 	virtual int seek(int pos, int whence) {
-		if (_fp) {
-			const int ret = gzseek(_fp, pos, whence);
-			if (ret == -1) {
-				return ret;
-			}
+		switch (whence) {
+		case SEEK_SET:
+			break;
+		case SEEK_CUR:
+			pos += _pos;
+			break;
+		case SEEK_END:
+			pos += _size;
+			break;
 		}
+		if (pos < 0) {
+			return -1;
+		}
+		_eof = (pos > _size);
+		_pos = MIN(pos, _size);
 		return 0;
 	}
-	virtual int read(void *p , int size) {
-		if (_fp) {
-			return gzread(_fp, p, size);
+	virtual int read(void *p, int size) {
+		if (size > _size - _pos) {
+			size = _size - _pos;
+			_eof = true;
 		}
-		return 0;
+		memcpy(p, _buf + _pos, size);
+		_pos += size;
+		return size;
 	}
 	virtual int write(const void *p, int size) {
-		if (_fp) {
-			return gzwrite(_fp, p, size);
+		if (!grow(_pos + size)) {
+			return 0;
 		}
-		return 0;
+		memcpy(_buf + _pos, p, size);
+		_pos += size;
+		_size = MAX(_size, _pos);
+		return size;
 	}
 };
 
+static uint32_t hashPath(const char *s) {
+	// case insensitive FNV-1a
+	uint32_t hash = 2166136261U;
+	for (; *s; ++s) {
+		hash ^= (uint8_t)tolower(*s);
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static const char *kFileIndexCacheName = "f2bgl.idx";
+static const char *kFileIndexCacheHeader = "F2BGL_FILE_INDEX 1";
+
 struct FileSystem {
 	char **_fileList;
 	int _fileCount;
 	int _filePathSkipLen;
+	uint32_t *_fileHashes;
+	int *_fileNext;
+	int *_hashBuckets;
+	int _hashMask;
+	char **_dirList; // directories and modification times, to validate the index cache
+	time_t *_dirTimes;
+	int _dirCount;
 
 	FileSystem() :
-		_fileList(0), _fileCount(0), _filePathSkipLen(0) {
+		_fileList(0), _fileCount(0), _filePathSkipLen(0),
+		_fileHashes(0), _fileNext(0), _hashBuckets(0), _hashMask(0),
+		_dirList(0), _dirTimes(0), _dirCount(0) {
 	}
 	~FileSystem() {
+		clear();
+	}
+	void clear() {
 		for (int i = 0; i < _fileCount; ++i) {
 			free(_fileList[i]);
 		}
 		free(_fileList);
+		_fileList = 0;
+		_fileCount = 0;
+		for (int i = 0; i < _dirCount; ++i) {
+			free(_dirList[i]);
+		}
+		free(_dirList);
+		_dirList = 0;
+		free(_dirTimes);
+		_dirTimes = 0;
+		_dirCount = 0;
+		free(_fileHashes);
+		_fileHashes = 0;
+		free(_fileNext);
+		_fileNext = 0;
+		free(_hashBuckets);
+		_hashBuckets = 0;
+		_hashMask = 0;
+	}
+	void addFile(const char *path) {
+		char **p = (char **)realloc(_fileList, (_fileCount + 1) * sizeof(char *));
+		if (p) {
+			_fileList = p;
+			_fileList[_fileCount] = strdup(path);
+			++_fileCount;
+		}
+	}
+	void addDirectory(const char *path, time_t mtime) {
+		char **p = (char **)realloc(_dirList, (_dirCount + 1) * sizeof(char *));
+		if (p) {
+			_dirList = p;
+			time_t *t = (time_t *)realloc(_dirTimes, (_dirCount + 1) * sizeof(time_t));
+			if (t) {
+				_dirTimes = t;
+				_dirList[_dirCount] = strdup(path);
+				_dirTimes[_dirCount] = mtime;
+				++_dirCount;
+			}
+		}
 	}
 	void buildFileListFromDirectory(const char *dir) {
 		DIR *d = opendir(dir);
 		if (d) {
+			struct stat st;
+			if (stat(dir, &st) == 0) {
+				addDirectory(dir + MIN<int>(_filePathSkipLen, strlen(dir)), st.st_mtime);
+			}
 			dirent *de;
 			while ((de = readdir(d)) != NULL) {
 				if (de->d_name[0] == '.') {
@@ -156,30 +347,135 @@ struct FileSystem {
 				}
 				char filePath[MAXPATHLEN];
 				snprintf(filePath, sizeof(filePath), "%s/%s", dir, de->d_name);
-				struct stat st;
 				if (stat(filePath, &st) == 0) {
 					if (S_ISDIR(st.st_mode)) {
 						buildFileListFromDirectory(filePath);
 					} else {
-						_fileList = (char **)realloc(_fileList, (_fileCount + 1) * sizeof(char *));
-						if (_fileList) {
-							_fileList[_fileCount] = strdup(filePath + _filePathSkipLen);
-							++_fileCount;
-						}
+						addFile(filePath + _filePathSkipLen);
 					}
 				}
 			}
 			closedir(d);
 		}
 	}
-	void setDataDirectory(const char *dir) {
+	void buildHashIndex() {
+		int size = 64;
+		while (size < _fileCount * 2) {
+			size <<= 1;
+		}
+		_hashBuckets = (int *)malloc(size * sizeof(int));
+		_fileHashes = (uint32_t *)malloc(_fileCount * sizeof(uint32_t));
+		_fileNext = (int *)malloc(_fileCount * sizeof(int));
+		if (!_hashBuckets || !_fileHashes || !_fileNext) {
+			error("Unable to allocate file index for %d files", _fileCount);
+		}
+		_hashMask = size - 1;
+		memset(_hashBuckets, 0xFF, size * sizeof(int));
+		// insert in reverse order, findPath returns the first listed file on collisions
+		for (int i = _fileCount - 1; i >= 0; --i) {
+			const uint32_t hash = hashPath(_fileList[i]);
+			_fileHashes[i] = hash;
+			_fileNext[i] = _hashBuckets[hash & _hashMask];
+			_hashBuckets[hash & _hashMask] = i;
+		}
+	}
+	void dirPath(const char *dataDir, const char *dir, char *path, int pathSize) const {
+		if (dir[0]) {
+			snprintf(path, pathSize, "%s/%s", dataDir, dir);
+		} else {
+			snprintf(path, pathSize, "%s", dataDir);
+		}
+	}
+	bool loadIndexCache(const char *cacheFile, const char *dataDir) {
+		FILE *fp = fopen(cacheFile, "r");
+		if (!fp) {
+			return false;
+		}
+		bool valid = false;
+		char buf[MAXPATHLEN + 32];
+		if (fgets(buf, sizeof(buf), fp) && strncmp(buf, kFileIndexCacheHeader, strlen(kFileIndexCacheHeader)) == 0) {
+			valid = true;
+			while (valid && fgets(buf, sizeof(buf), fp)) {
+				char *p = strchr(buf, '\n');
+				if (p) {
+					*p = 0;
+				}
+				if (buf[0] == 'F' && buf[1] == ' ') {
+					addFile(buf + 2);
+				} else if (buf[0] == 'D' && buf[1] == ' ') {
+					// the entries of a directory have changed if its modification time differs
+					char *name = 0;
+					const time_t mtime = (time_t)strtoll(buf + 2, &name, 10);
+					if (!name || *name != ' ') {
+						valid = false;
+						break;
+					}
+					++name;
+					char path[MAXPATHLEN];
+					dirPath(dataDir, name, path, sizeof(path));
+					struct stat st;
+					if (stat(path, &st) != 0 || st.st_mtime != mtime) {
+						debug(kDebug_FILE, "FileSystem::loadIndexCache() directory '%s' changed", path);
+						valid = false;
+						break;
+					}
+					addDirectory(name, mtime);
+				}
+			}
+		}
+		fclose(fp);
+		if (!valid) {
+			clear();
+		}
+		return valid;
+	}
+	void saveIndexCache(const char *cacheFile) const {
+		// modification times have a one second resolution, changes made in the same second would go unnoticed
+		const time_t now = time(0);
+		for (int i = 0; i < _dirCount; ++i) {
+			if (_dirTimes[i] >= now - 1) {
+				debug(kDebug_FILE, "FileSystem::saveIndexCache() directory '%s' recently modified", _dirList[i]);
+				return;
+			}
+		}
+		FILE *fp = fopen(cacheFile, "w");
+		if (!fp) {
+			warning("Unable to write file index cache '%s'", cacheFile);
+			return;
+		}
+		fprintf(fp, "%s\n", kFileIndexCacheHeader);
+		for (int i = 0; i < _dirCount; ++i) {
+			fprintf(fp, "D %lld %s\n", (long long)_dirTimes[i], _dirList[i]);
+		}
+		for (int i = 0; i < _fileCount; ++i) {
+			fprintf(fp, "F %s\n", _fileList[i]);
+		}
+		fclose(fp);
+	}
+	void setDataDirectory(const char *dir, const char *cacheDir = 0) {
 		_filePathSkipLen = strlen(dir) + 1;
-		buildFileListFromDirectory(dir);
-		debug(kDebug_FILE, "FileSystem::setDataDirectory('%s') %d files", dir, _fileCount);
+		char cacheFile[MAXPATHLEN];
+		bool cached = false;
+		if (cacheDir) {
+			snprintf(cacheFile, sizeof(cacheFile), "%s/%s", cacheDir, kFileIndexCacheName);
+			cached = loadIndexCache(cacheFile, dir);
+		}
+		if (!cached) {
+			buildFileListFromDirectory(dir);
+			if (cacheDir) {
+				saveIndexCache(cacheFile);
+			}
+		}
+		buildHashIndex();
+		debug(kDebug_FILE, "FileSystem::setDataDirectory('%s') %d files cached %d", dir, _fileCount, cached);
 	}
 	const char *findPath(const char *file) const {
-		for (int i = 0; i < _fileCount; ++i) {
-			if (strcasecmp(_fileList[i], file) == 0) {
+		if (_fileCount == 0) {
+			return 0;
+		}
+		const uint32_t hash = hashPath(file);
+		for (int i = _hashBuckets[hash & _hashMask]; i >= 0; i = _fileNext[i]) {
+			if (_fileHashes[i] == hash && strcasecmp(_fileList[i], file) == 0) {
 				debug(kDebug_FILE, "FileSystem::findPath() '%s'", file);
 				return _fileList[i];
 			}
@@ -195,7 +491,7 @@ static int _fileLanguage;
 static int _fileVoice;
 const char *g_fileDataPath;
 const char *g_fileSavePath;
-static bool _exitOnError = true;
+static __thread bool _exitOnError = true; // cleared on the background loading threads
 static FileSystem *_fileSystem;
 static const char *_psxDataPath;
 
@@ -227,13 +523,27 @@ static void fileMakeFilePath(const char *fileName, int fileType, int fileLang, c
 	strcat(filePath, fileName);
 }
 
-static File *fileOpenIntern(const char *fileName, int fileType, const char *prefixPath = "") {
+static const char *fileFindPath(const char *fileName, int fileType, const char *prefixPath = "") {
 	char filePath[MAXPATHLEN];
 	strcpy(filePath, prefixPath);
 	fileMakeFilePath(fileName, fileType, _fileLanguage, filePath);
-	debug(kDebug_FILE, "fileOpenIntern() path '%s'", filePath);
+	debug(kDebug_FILE, "fileFindPath() path '%s'", filePath);
 	const char *path = _fileSystem->findPath(filePath);
 	if (path) {
+		return path;
+	}
+	// on the original CD-ROM, the TEXT/ and VOICE/ directories are under DATA/.
+	// the original installer would copy them at the same level as DATA/.
+	if ((fileType == kFileType_TEXT || fileType == kFileType_VOICE) && !prefixPath[0]) {
+		return fileFindPath(fileName, fileType, "DATA/");
+	}
+	return 0;
+}
+
+static File *fileOpenIntern(const char *fileName, int fileType) {
+	const char *path = fileFindPath(fileName, fileType);
+	if (path) {
+		char filePath[MAXPATHLEN];
 		snprintf(filePath, sizeof(filePath), "%s/%s", g_fileDataPath, path);
 		File *fp = new StdioFile;
 		if (!fp->open(filePath, "rb")) {
@@ -242,16 +552,12 @@ static File *fileOpenIntern(const char *fileName, int fileType, const char *pref
 		}
 		return fp;
 	}
-	// on the original CD-ROM, the TEXT/ and VOICE/ directories are under DATA/.
-	// the original installer would copy them at the same level as DATA/.
-	if ((fileType == kFileType_TEXT || fileType == kFileType_VOICE) && !prefixPath[0]) {
-		return fileOpenIntern(fileName, fileType, "DATA/");
-	}
 	return 0;
 }
 
 bool fileExists(const char *fileName, int fileType) {
 	if (fileType == kFileType_SAVE || fileType == kFileType_LOAD || fileType == kFileType_SCREENSHOT_LOAD || fileType == kFileType_CONFIG) {
+		waitGzipWriteThread();
 		char filePath[MAXPATHLEN];
 		snprintf(filePath, sizeof(filePath), "%s/%s", g_fileSavePath, fileName);
 		struct stat st;
@@ -264,23 +570,16 @@ bool fileExists(const char *fileName, int fileType) {
 			fileType = kFileType_DATA;
 		}
 	}
-	bool exists = false;
-	File *fp = fileOpenIntern(fileName, fileType);
-	if (fp) {
-		fp->close();
-		delete fp;
-		exists = true;
-	}
-	return exists;
+	return fileFindPath(fileName, fileType) != 0;
 }
 
-bool fileInit(int language, int voice, const char *dataPath, const char *savePath) {
+bool fileInit(int language, int voice, const char *dataPath, const char *savePath, bool indexCache) {
 	_fileLanguage = language;
 	_fileVoice = voice;
 	g_fileDataPath = dataPath;
 	g_fileSavePath = savePath;
 	_fileSystem = new FileSystem;
-	_fileSystem->setDataDirectory(dataPath);
+	_fileSystem->setDataDirectory(dataPath, indexCache ? savePath : 0);
 	bool ret = fileExists("player.ini", kFileType_DATA);
 	if (ret) {
 		g_isDemo = fileExists("ddtitle.cin", kFileType_DATA);
@@ -310,7 +609,8 @@ File *fileOpen(const char *fileName, int *fileSize, int fileType, bool errorIfNo
 		switch (fileType) {
 		case kFileType_LOAD:
 		case kFileType_SAVE:
-			fp = new GzipFile;
+			waitGzipWriteThread();
+			fp = new BufferedGzipFile;
 			break;
 		case kFileType_SCREENSHOT_LOAD:
 		case kFileType_SCREENSHOT_SAVE:
@@ -360,6 +660,13 @@ File *fileOpen(const char *fileName, int *fileSize, int fileType, bool errorIfNo
 	return fp;
 }
 
+bool fileWaitPendingWrites() {
+	waitGzipWriteThread();
+	const bool ok = !_gzipWriteJob.failed;
+	_gzipWriteJob.failed = false;
+	return ok;
+}
+
 void fileClose(File *fp) {
 	if (fp) {
 		fp->close();
@@ -415,6 +722,14 @@ int fileEof(File *fp) {
 	return fp->eof();
 }
 
+void fileSetExitOnError(bool exitOnError) {
+	_exitOnError = exitOnError;
+}
+
+bool fileIoError(File *fp) {
+	return fp->err() != 0;
+}
+
 uint32_t fileCrc32(File *fp) {
 	uint32_t crc = 0;
 	const uint32_t pos = fp->seek(0, SEEK_SET);
@@ -467,6 +782,18 @@ void fileWriteLine(File *fp, const char *s, ...) {
 	fileWrite(fp, buf, strlen(buf));
 }
 
+uint8_t *fileMap(File *fp, int size) {
+	return fp->map(size);
+}
+
+void fileUnmap(uint8_t *p, int size) {
+#ifndef _WIN32
+	if (p) {
+		munmap(p, size);
+	}
+#endif
+}
+
 int fileSize(File *fp) {
 	const int pos = fp->seek(0, SEEK_END);
 	const int size = fp->tell();
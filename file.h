@@ -49,12 +49,13 @@ extern uint32_t g_level1ObjCrc; // crc for savegame states
 extern const char *g_fileDataPath;
 extern const char *g_fileSavePath;
 
-bool fileInit(int language, int voice, const char *dataPath, const char *savePath);
+bool fileInit(int language, int voice, const char *dataPath, const char *savePath, bool indexCache = false);
 int fileLanguage();
 int fileVoice();
 bool fileExists(const char *fileName, int fileType);
 File *fileOpen(const char *fileName, int *fileSize, int fileType, bool errorIfNotFound = true);
 void fileClose(File *fp);
+bool fileWaitPendingWrites();
 int fileRead(File *fp, void *buf, int size);
 uint8_t fileReadByte(File *fp);
 uint16_t fileReadUint16LE(File *fp);
@@ -62,6 +63,8 @@ uint32_t fileReadUint32LE(File *fp);
 uint32_t fileGetPos(File *fp);
 void fileSetPos(File *fp, uint32_t pos, int origin);
 int fileEof(File *fp);
+void fileSetExitOnError(bool exitOnError);
+bool fileIoError(File *fp);
 uint32_t fileCrc32(File *fp);
 void fileWrite(File *fp, const void *buf, int size);
 void fileWriteByte(File *fp, uint8_t value);
@@ -69,6 +72,8 @@ void fileWriteUint16LE(File *fp, uint16_t value);
 void fileWriteUint32LE(File *fp, uint32_t value);
 void fileWriteLine(File *fp, const char *s, ...);
 int fileSize(File *fp);
+uint8_t *fileMap(File *fp, int size);
+void fileUnmap(uint8_t *p, int size);
 bool fileInitPsx(const char *dataPath);
 File *fileOpenPsx(const char *filename, int fileType, int levelNum = -1);
 
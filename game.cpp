@@ -21,6 +21,13 @@ Game::Game(Render *render, const GameParams *params)
 
 	_displayPsxLevelLoadingScreen = 0;
 
+	_tickStats = 0;
+
+	_scriptInstructions = 0;
+	_scriptInstructionsCount = 0;
+	_scriptCmds = 0;
+	_scriptCmdsCount = 0;
+
 	_ticks = 0;
 	_level = 0;
 	_skillLevel = kSkillNormal;
@@ -40,17 +47,27 @@ Game::Game(Render *render, const GameParams *params)
 	memset(_sceneTextureImagesBuffer, 0, sizeof(_sceneTextureImagesBuffer));
 	memset(_sceneObjectsTable, 0, sizeof(_sceneObjectsTable));
 	memset(_sceneCellMap, 0, sizeof(_sceneCellMap));
+	_sceneVisibility.valid = false;
+	_sceneVisibility.cellsCount = 0;
+	memset(_colSlotsChunks, 0, sizeof(_colSlotsChunks));
+	_colSlotsChunksCount = 0;
+	_colSlotsChunkSize = 0;
+	_colSlotsFreeList = 0;
+	_colSlotsUsed = _colSlotsHighWater = 0;
 	memset(_playerMessagesTable, 0, sizeof(_playerMessagesTable));
 
 	memset(_saveLoadTextureIdTable, 0, sizeof(_saveLoadTextureIdTable));
 
 	_iconsCount = 0;
 	memset(_iconsTable, 0, sizeof(_iconsTable));
+
+	memset(&_particles, 0, sizeof(_particles));
 }
 
 Game::~Game() {
 	finiIcons();
 	freeLevelData();
+	freeParticles();
 }
 
 void Game::clearGlobalData() {
@@ -137,6 +154,7 @@ void Game::clearLevelData() {
 
 	finiIcons();
 	_spriteCache.flush();
+	_meshCache.flush();
 	_infoPanelSpr.data = 0;
 	_render->flushCachedTextures();
 
@@ -148,9 +166,12 @@ void Game::clearLevelData() {
 	}
 
 	memset(_sceneCellMap, 0, sizeof(_sceneCellMap));
+	_sceneVisibility.valid = false;
+	_sceneVisibility.cellsCount = 0;
 }
 
 void Game::freeLevelData() {
+	freeObjectScripts();
 	for (int i = 0; i < ARRAYSIZE(_objectKeysTable); ++i) {
 		GameObject *o = _objectKeysTable[i];
 		if (o) {
@@ -165,14 +186,10 @@ void Game::freeLevelData() {
 	}
 	for (int x = 0; x < kMapSizeX; ++x) {
 		for (int z = 0; z < kMapSizeZ; ++z) {
-			CollisionSlot *slot = _sceneCellMap[x][z].colSlot;
-			while (slot) {
-				CollisionSlot *next = slot->next;
-				free(slot);
-				slot = next;
-			}
+			_sceneCellMap[x][z].colSlot = 0;
 		}
 	}
+	freeCollisionSlotsPool();
 }
 
 void Game::countObjects(int16_t parentKey) {
@@ -577,6 +594,7 @@ void Game::setupObjects() {
 	_objectsCount = 0;
 	countObjects(_res.getRoot(kResType_OBJ));
 	debug(kDebug_GAME, "Game::setupObjects() _objectsCount=%d", _objectsCount);
+	initCollisionSlotsPool(_objectsCount);
 
 	GameObject *o_world = ALLOC<GameObject>(_objectsCount);
 
@@ -1074,6 +1092,76 @@ void Game::loadSceneTextures(int16_t key) {
 	}
 }
 
+static int16_t getFrameSpriteKey(Resource &res, int16_t key) {
+	// 0 for the mesh frames (type 9) and the missing sprites, getData() would assert
+	const uint8_t *p_frm = res.getData(kResType_ANI, key, "ANIFRAM");
+	if (!p_frm || p_frm[2] != 1) {
+		return 0;
+	}
+	const int16_t sprKey = READ_LE_UINT16(p_frm);
+	if (sprKey <= 0 || sprKey >= res._treesTableCount[kResType_SPR] || !res._treesTable[kResType_SPR][sprKey].data) {
+		return 0;
+	}
+	return sprKey;
+}
+
+void Game::addToSceneTexturesAtlas(int16_t aniKey) {
+	for (int16_t frmKey = _res.getChild(kResType_ANI, aniKey); frmKey > 0; frmKey = _res.getNext(kResType_ANI, frmKey)) {
+		for (int16_t key = _res.getChild(kResType_ANI, frmKey); key > 0; key = _res.getNext(kResType_ANI, key)) {
+			const int16_t sprKey = getFrameSpriteKey(_res, key);
+			if (sprKey == 0) {
+				continue;
+			}
+			SpriteImage spr;
+			initSprite(kResType_SPR, sprKey, &spr);
+			if (spr.w == 64 && (spr.h == 64 || spr.h == 16)) {
+				const uint8_t *texData = _spriteCache.getData(spr.key, spr.data);
+				if (texData) {
+					_render->addToTextureAtlas(texData, spr.w, spr.h, spr.key);
+				}
+			}
+		}
+	}
+}
+
+void Game::loadSceneTexturesAtlas() {
+	// pack the wall and ground bitmaps of all animation frames
+	_render->beginTextureAtlas();
+	for (int i = 2; i < _sceneAnimationsCount; ++i) {
+		if (_sceneAnimationsTable[i].aniKey != 0) {
+			addToSceneTexturesAtlas(_sceneAnimationsTable[i].aniKey);
+		}
+	}
+	for (int i = 0; i < _sceneTexturesCount; ++i) {
+		addToSceneTexturesAtlas(_sceneTexturesTable[i].key);
+	}
+	_render->endTextureAtlas();
+}
+
+void Game::queueSceneSprites(int16_t aniKey) {
+	for (int16_t frmKey = _res.getChild(kResType_ANI, aniKey); frmKey > 0; frmKey = _res.getNext(kResType_ANI, frmKey)) {
+		for (int16_t key = _res.getChild(kResType_ANI, frmKey); key > 0; key = _res.getNext(kResType_ANI, key)) {
+			const int16_t sprKey = getFrameSpriteKey(_res, key);
+			if (sprKey != 0) {
+				_spriteCache.queueSprite(sprKey, _res.getData(kResType_SPR, sprKey, "SPRDATA"));
+			}
+		}
+	}
+}
+
+void Game::preloadSceneSprites() {
+	// decode the scene bitmaps now rather than when first drawn
+	for (int i = 2; i < _sceneAnimationsCount; ++i) {
+		if (_sceneAnimationsTable[i].aniKey != 0) {
+			queueSceneSprites(_sceneAnimationsTable[i].aniKey);
+		}
+	}
+	for (int i = 0; i < _sceneTexturesCount; ++i) {
+		queueSceneSprites(_sceneTexturesTable[i].key);
+	}
+	_spriteCache.preloadSprites();
+}
+
 void Game::updateSceneTextures() {
 	for (int i = 0; i < _sceneTexturesCount; ++i) {
 		SceneTexture *st = &_sceneTexturesTable[i];
@@ -1088,6 +1176,10 @@ void Game::initScene() {
 	debug(kDebug_GAME, "Game::initScene() initial room %d", o->room);
 	_roomsTable[o->room].fl = 1;
 	loadSceneTextures(_mapKey);
+	if (_params.preloadSprites) {
+		preloadSceneSprites();
+	}
+	loadSceneTexturesAtlas();
 	fixRoomData();
 	_rayCastCounter = 0;
 	if (_updatePalette) {
@@ -1123,6 +1215,7 @@ void Game::init() {
 	_snd._mix.setSoundVolume(_res._userConfig.soundOn ? _res._userConfig.soundVolume : 0);
 	_snd._mix.setMusicVolume(_res._userConfig.musicOn ? _res._userConfig.musicVolume : 0);
 	_snd._mix.setVoiceVolume(_res._userConfig.voiceOn ? _res._userConfig.voiceVolume : 0);
+	_snd._sfxCacheMaxSize = _params.sfxCacheSize << 20;
 	_snd.init(midiType);
 
 	_ticks = 0;
@@ -1194,7 +1287,7 @@ void Game::initLevel(bool keepInventoryObjects) {
 	memset(_screenPalette, 0, sizeof(_screenPalette));
 	memset(_indirectPalette, 0, sizeof(_indirectPalette));
 	memset(_mrkBuffer, 0, sizeof(_mrkBuffer));
-	_particlesCount = 0;
+	_particles.count = 0;
 
 	_mainLoopCurrentMode = 0;
 	_conradHit = 0;
@@ -1203,12 +1296,16 @@ void Game::initLevel(bool keepInventoryObjects) {
 
 	clearGlobalData();
 	_varsTable[kVarConradLife] = 2000;
-	_res.loadLevelData(_level);
+	if (!_res.loadPrefetchedLevelData(_level)) {
+		_res.loadLevelData(_level);
+	}
 	if (g_hasPsx) {
 		_res.loadLevelDataPsx(_level, kResTypePsx_DIN);
 		_res.loadLevelDataPsx(_level, kResTypePsx_LEV);
 		_res.loadLevelDataPsx(_level, kResTypePsx_SON);
 	}
+	compileObjectScripts();
+	_snd.preloadSfx();
 	_mapKey = _res.getKeyFromPath(_res._levelDescriptionsTable[_level].mapKey);
 	getAllPalKeys(_mapKey);
 	for (int i = 0; i < kSoundKeyPathsTableSize; ++i) {
@@ -1754,6 +1851,187 @@ int Game::executeObjectScriptOpcode(GameObject *o, uint32_t op, const uint8_t *&
 	return (this->*_opcodeTable[op])(argc, argv);
 }
 
+static uint8_t getScriptParamType(int param) {
+	if (param >= 256) {
+		return kScriptParam_Special;
+	} else if (param >= 128) {
+		return kScriptParam_Var;
+	} else if (param >= 96) {
+		return kScriptParam_ObjectFlag;
+	}
+	return kScriptParam_ObjectData;
+}
+
+bool Game::compileObjectScriptOpcode(uint32_t op, const uint8_t *&data, ScriptInstruction *ins) {
+	// same decoding as executeObjectScriptOpcode, the parameters are resolved when executed
+	uint32_t mask;
+	if (_res._psxCmdData) {
+		mask = op >> 8;
+		op &= 0xFF;
+	} else {
+		mask = READ_LE_UINT32(data); data += 4;
+	}
+	if (op >= kOpcodesCount || !_opcodeTable[op]) {
+		return false;
+	}
+	const int argc = g_isDemo ? _opcodeSize_demo[op] : _opcodeSize[op];
+	assert(argc <= 8);
+	uint32_t type = 0;
+	if (_res._psxCmdData && argc >= 2) {
+		type = READ_LE_UINT16(data); data += 2;
+	}
+	ins->proc = _opcodeTable[op];
+	ins->argc = argc;
+	for (int i = 0; i < argc; ++i) {
+		int32_t val;
+		if (_res._psxCmdData && argc >= 2) {
+			switch ((type >> (2 * i)) & 3) {
+			case 1:
+				val = (int16_t)READ_LE_UINT16(data); data += 2;
+				break;
+			case 2:
+				val = READ_LE_UINT16(data) << 16; data += 2;
+				break;
+			case 3:
+				val = READ_LE_UINT32(data); data += 4;
+				break;
+			default:
+				val = 0;
+				break;
+			}
+		} else {
+			val = READ_LE_UINT32(data); data += 4;
+		}
+		if (mask & (1 << i)) {
+			ins->paramTypes[i] = getScriptParamType(val);
+			if (ins->paramTypes[i] == kScriptParam_Var) {
+				val -= 128;
+			}
+		} else {
+			ins->paramTypes[i] = kScriptParam_Immediate;
+		}
+		ins->argv[i] = val;
+	}
+	return true;
+}
+
+void Game::freeObjectScripts() {
+	free(_scriptInstructions);
+	_scriptInstructions = 0;
+	_scriptInstructionsCount = 0;
+	free(_scriptCmds);
+	_scriptCmds = 0;
+	_scriptCmdsCount = 0;
+}
+
+void Game::compileObjectScripts() {
+	freeObjectScripts();
+	const int count = _res._cmdOffsetsTableCount;
+	_scriptCmds = ALLOC<ScriptCmd>(count);
+	if (!_scriptCmds) {
+		return;
+	}
+	_scriptCmdsCount = count;
+	int instructionsSize = 0;
+	int failedCount = 0;
+	for (int num = 0; num < count; ++num) {
+		ScriptCmd *cmd = &_scriptCmds[num];
+		cmd->first = _scriptInstructionsCount;
+		cmd->condCount = cmd->stmtCount = 0;
+		const uint8_t *data = _res.getCmdData(num);
+		int section = 0; // conditions then statements
+		while (section < 2) {
+			int32_t op;
+			if (_res._psxCmdData) {
+				op = (int16_t)READ_LE_UINT16(data); data += 2;
+			} else {
+				op = READ_LE_UINT32(data); data += 4;
+			}
+			if (op == (section == 0 ? -1 : -2)) {
+				++section;
+				continue;
+			}
+			if (_scriptInstructionsCount == instructionsSize) {
+				instructionsSize += 4096;
+				ScriptInstruction *p = (ScriptInstruction *)realloc(_scriptInstructions, instructionsSize * sizeof(ScriptInstruction));
+				if (!p) {
+					error("Unable to allocate %d script instructions", instructionsSize);
+				}
+				_scriptInstructions = p;
+			}
+			ScriptInstruction *ins = &_scriptInstructions[_scriptInstructionsCount];
+			ins->negate = false;
+			if (section == 0 && (op & 0x80) != 0) {
+				ins->negate = true;
+				op &= ~0x80;
+			}
+			if (!compileObjectScriptOpcode(op, data, ins)) {
+				break;
+			}
+			++_scriptInstructionsCount;
+			if (section == 0) {
+				++cmd->condCount;
+			} else {
+				++cmd->stmtCount;
+			}
+		}
+		if (section < 2) {
+			// unknown opcode, keep the bytecode interpreter for that command
+			_scriptInstructionsCount = cmd->first;
+			cmd->first = -1;
+			++failedCount;
+		}
+	}
+	debug(kDebug_GAME, "Game::compileObjectScripts() commands %d instructions %d interpreted %d", count, _scriptInstructionsCount, failedCount);
+}
+
+int Game::executeScriptInstruction(GameObject *o, const ScriptInstruction *ins) {
+	int32_t argv[8];
+	for (int i = 0; i < ins->argc; ++i) {
+		const int32_t val = ins->argv[i];
+		switch (ins->paramTypes[i]) {
+		case kScriptParam_Immediate:
+			argv[i] = val;
+			break;
+		case kScriptParam_ObjectData:
+			argv[i] = o->getData(val);
+			if (val == 20) {
+				argv[i] &= 15;
+			}
+			break;
+		case kScriptParam_ObjectFlag:
+			argv[i] = getObjectFlag(o, val);
+			break;
+		case kScriptParam_Var:
+			argv[i] = _varsTable[val];
+			break;
+		default:
+			argv[i] = getObjectScriptParam(o, val);
+			break;
+		}
+	}
+	return (this->*(ins->proc))(ins->argc, argv);
+}
+
+// returns true if the conditions are met and the statements were executed
+int Game::executeScriptCmd(GameObject *o, int num) {
+	const ScriptCmd *cmd = &_scriptCmds[num];
+	const ScriptInstruction *ins = &_scriptInstructions[cmd->first];
+	for (int i = 0; i < cmd->condCount; ++i, ++ins) {
+		int ret = executeScriptInstruction(o, ins);
+		if (ins->negate) {
+			ret = ~ret;
+		}
+		if (!ret) {
+			return 0;
+		}
+	}
+	for (int i = 0; i < cmd->stmtCount; ++i, ++ins) {
+		executeScriptInstruction(o, ins);
+	}
+	return 1;
+}
+
 uint8_t *Game::getStartScriptAnim() {
 	uint8_t *p = 0;
 	if (_currentObject->scriptStateKey > 0) {
@@ -1872,6 +2150,14 @@ int Game::executeObjectScript(GameObject *o) {
 					}
 				}
 			}
+			if (scriptCmdNum < _scriptCmdsCount && _scriptCmds[scriptCmdNum].first >= 0) {
+				stopScript = executeScriptCmd(_currentObject, scriptCmdNum);
+				if (!stopScript) {
+					prevScriptCmdNum = scriptCmdNum;
+					_currentObject->scriptCondData = getNextScriptAnim();
+				}
+				continue;
+			}
 			const uint8_t *scriptData = _res.getCmdData(scriptCmdNum);
 			int scriptRet = 1;
 			while (scriptRet) {
@@ -2589,8 +2875,11 @@ void Game::updateObjects() {
 
 void Game::doTick() {
 	const int currentRoom = _room;
-	updateSceneAnimations();
-	updateSceneTextures();
+	{
+		TickPhase phase(_tickStats, kTickPhase_SceneAnimations);
+		updateSceneAnimations();
+		updateSceneTextures();
+	}
 	if (_mainLoopCurrentMode == 0) {
 		if (_musicPaused) {
 			_musicPaused = false;
@@ -2615,18 +2904,30 @@ void Game::doTick() {
 			break;
 		}
 	}
-	updatePlayerObject();
-	redrawScene();
+	{
+		TickPhase phase(_tickStats, kTickPhase_PlayerUpdate);
+		updatePlayerObject();
+	}
+	{
+		TickPhase phase(_tickStats, kTickPhase_RedrawScene);
+		redrawScene();
+	}
 	if (_changedObjectsCount != 0) {
 		updateChangedObjects();
 	}
-	addObjectsToScene();
+	{
+		TickPhase phase(_tickStats, kTickPhase_AddObjectsToScene);
+		addObjectsToScene();
+	}
 	updateObjects();
 	++_ticks;
 	if ((_params.cheats & kCheatLifeCounter) != 0) {
 		_objectsPtrTable[kObjPtrConrad]->specialData[1][18] = _varsTable[kVarConradLife];
 	}
-	runObject(_objectsPtrTable[kObjPtrWorld]->o_child);
+	{
+		TickPhase phase(_tickStats, kTickPhase_RunObject);
+		runObject(_objectsPtrTable[kObjPtrWorld]->o_child);
+	}
 	if (_mainLoopCurrentMode == 1) {
 		GameObject *o_ply = getObjectByKey(_varsTable[kVarPlayerObject]);
 		CellMap *cell = getCellMapShr19(o_ply->xPosParent + o_ply->xPos, o_ply->zPosParent + o_ply->zPos);
@@ -2737,6 +3038,7 @@ void Game::doTick() {
 		}
 	}
 	if (_collidingObjectsCount != 0) {
+		TickPhase phase(_tickStats, kTickPhase_Collisions);
 		updateCollidingObjects();
 	}
 }
@@ -2904,15 +3206,53 @@ void Game::clearObjectsDrawList() {
 	_objectsDrawCount = 0;
 }
 
-static int _compareBackToFront_xPos;
-static int _compareBackToFront_zPos;
-
-static int compareSceneObjectBackToFront(const void *p1, const void *p2) {
-	const SceneObject *o1 = *(const SceneObject **)p1;
-	const SceneObject *o2 = *(const SceneObject **)p2;
-	const int dist1 = getSquareDistance(o1->x, o1->z, _compareBackToFront_xPos, _compareBackToFront_zPos, kPosShift);
-	const int dist2 = getSquareDistance(o2->x, o2->z, _compareBackToFront_xPos, _compareBackToFront_zPos, kPosShift);
-	return dist2 - dist1;
+static void sortSceneObjectsBackToFront(SceneObject **objects, int count, int xPos, int zPos) {
+	// stable LSD radix sort on the distance to the observer, objects at the same distance keep their order
+	uint32_t keys[2][kSceneObjectsTableSize];
+	SceneObject *tmp[kSceneObjectsTableSize];
+	assert(count <= kSceneObjectsTableSize);
+	bool sorted = true;
+	for (int i = 0; i < count; ++i) {
+		// farthest first
+		keys[0][i] = ~(uint32_t)getSquareDistance(objects[i]->x, objects[i]->z, xPos, zPos, kPosShift);
+		if (i != 0 && keys[0][i] < keys[0][i - 1]) {
+			sorted = false;
+		}
+	}
+	if (sorted) {
+		return;
+	}
+	uint32_t *srcKeys = keys[0];
+	uint32_t *dstKeys = keys[1];
+	SceneObject **src = objects;
+	SceneObject **dst = tmp;
+	for (int shift = 0; shift < 32; shift += 8) {
+		int offsets[256];
+		memset(offsets, 0, sizeof(offsets));
+		for (int i = 0; i < count; ++i) {
+			++offsets[(srcKeys[i] >> shift) & 255];
+		}
+		if (offsets[(srcKeys[0] >> shift) & 255] == count) {
+			// same digit for all objects
+			continue;
+		}
+		int offset = 0;
+		for (int i = 0; i < 256; ++i) {
+			const int n = offsets[i];
+			offsets[i] = offset;
+			offset += n;
+		}
+		for (int i = 0; i < count; ++i) {
+			const int pos = offsets[(srcKeys[i] >> shift) & 255]++;
+			dstKeys[pos] = srcKeys[i];
+			dst[pos] = src[i];
+		}
+		SWAP(srcKeys, dstKeys);
+		SWAP(src, dst);
+	}
+	if (src != objects) {
+		memcpy(objects, src, count * sizeof(SceneObject *));
+	}
 }
 
 void Game::addObjectsToScene() {
@@ -2951,7 +3291,7 @@ void Game::addObjectsToScene() {
 		SceneObject *so = &_sceneObjectsTable[i];
 		const int flags = so->o->flags[1];
 		if (so->polygonsData && (so->polygonsData[0] & 0x80) && (flags & 0x2400) == 0) {
-			_render->beginObjectDraw(so->x, 0, so->z, so->pitch, kPosShift);
+			_render->beginObjectDraw(so->x, 0, so->z, so->pitch, kPosShift, so->o->objKey);
 			drawSceneObjectShadow(so);
 			_render->endObjectDraw();
 		}
@@ -2964,7 +3304,7 @@ void Game::addObjectsToScene() {
 			++translucentObjectsCount;
 		} else {
 			if (so->verticesCount != 0) {
-				_render->beginObjectDraw(so->x, so->y, so->z, so->pitch, kPosShift);
+				_render->beginObjectDraw(so->x, so->y, so->z, so->pitch, kPosShift, so->o->objKey);
 				drawSceneObjectMesh(so, so->o->flags[1]);
 				_render->endObjectDraw();
 			} else {
@@ -2973,13 +3313,11 @@ void Game::addObjectsToScene() {
 			}
 		}
 	}
-	_compareBackToFront_xPos = _xPosObserver;
-	_compareBackToFront_zPos = _zPosObserver;
-	qsort(translucentObjects, translucentObjectsCount, sizeof(SceneObject *), compareSceneObjectBackToFront);
+	sortSceneObjectsBackToFront(translucentObjects, translucentObjectsCount, _xPosObserver, _zPosObserver);
 	// draw transparent
 	for (int i = 0; i < translucentObjectsCount; ++i) {
 		SceneObject *so = translucentObjects[i];
-		_render->beginObjectDraw(so->x, so->y, so->z, so->pitch, kPosShift);
+		_render->beginObjectDraw(so->x, so->y, so->z, so->pitch, kPosShift, so->o->objKey);
 		drawSceneObjectMesh(so, so->o->flags[1]);
 		_render->endObjectDraw();
 	}
@@ -3000,7 +3338,7 @@ void Game::addObjectsToScene() {
 		v[1].x = x1; v[1].y = y0; v[1].z = 0;
 		v[2].x = x1; v[2].y = y1; v[2].z = 0;
 		v[3].x = x0; v[3].y = y1; v[3].z = 0;
-		_render->beginObjectDraw(so->x, (kGroundY << kPosShift) + so->y, so->z, _yInvRotObserver, kPosShift);
+		_render->beginObjectDraw(so->x, (kGroundY << kPosShift) + so->y, so->z, _yInvRotObserver, kPosShift, so->o->objKey);
 		_render->drawPolygonTexture(v, 4, 0, texData, spr->w, spr->h, spr->key);
 		_render->endObjectDraw();
 	}
@@ -3086,36 +3424,15 @@ void Game::drawSceneObjectShadow(SceneObject *so) {
 }
 
 void Game::drawSceneObjectMesh(SceneObject *so, int flags) {
-	const uint8_t *polygonsData = so->polygonsData;
-	const uint8_t *verticesData = so->verticesData;
-	const int verticesCount = so->verticesCount;
-	if (polygonsData[0] & 0x80) {
-		const int shadowPolySize = -(int8_t)polygonsData[0];
-		polygonsData += shadowPolySize;
+	// the polygons points are decoded once per mesh frame
+	const Mesh *mesh = _meshCache.getMesh(so->polygonsData, so->verticesData, so->verticesCount);
+	if (!mesh) {
+		return;
 	}
-	int count = *polygonsData++;
-	while (count != 0) {
-		int color = READ_LE_UINT16(polygonsData); polygonsData += 2;
-		Vertex polygonPoints[16];
-		if (count & 0x40) {
-			count &= 15;
-			for (int i = 0; i <= count; ++i) {
-				int index = *polygonsData++;
-				if (index >= verticesCount) {
-					warning("Game::drawSceneObjectMesh() invalid index %d in vertex buffer (size %d)", index, verticesCount);
-					return;
-				}
-				assert(index < verticesCount);
-				polygonPoints[i] = READ_VERTEX32(verticesData + index * 4);
-			}
-		} else {
-			count &= 15;
-			for (int i = 0; i <= count; ++i) {
-				int index = READ_LE_UINT16(polygonsData); polygonsData += 2;
-				assert(index < verticesCount);
-				polygonPoints[i] = READ_VERTEX32(verticesData + index * 4);
-			}
-		}
+	const Vertex *polygonPoints = mesh->points;
+	for (int j = 0; j < mesh->polygonsCount; ++j) {
+		int color = mesh->polygons[j].color;
+		const int count = mesh->polygons[j].count - 1;
 		if (flags & 0x40000) {
 			const int y = (kGroundY << 15) + (polygonPoints[0].y << 1);
 			addParticleBlob(so, polygonPoints[0].x, y, polygonPoints[0].z, 5, 6, color & 255);
@@ -3201,7 +3518,7 @@ void Game::drawSceneObjectMesh(SceneObject *so, int flags) {
 				_render->drawPolygonFlat(polygonPoints, count + 1, color);
 			}
 		}
-		count = *polygonsData++;
+		polygonPoints += count + 1;
 	}
 }
 
@@ -3225,6 +3542,11 @@ void Game::drawWall(const Vertex *vertices, int verticesCount, int texture, int
 				if (spr->w != 64 || (spr->h != 16 && spr->h != 64)) {
 					// warning("Unexpected wall sprite dimensions %d,%d key %d", spr->w, spr->h, spr->key);
 				}
+				if (maskedWall && _render->hasTexture(kTexKeyWall + spr->key)) {
+					// the masked copy is only built when the texture is not resident
+					_render->drawPolygonTexture(vertices, verticesCount, 0, 0, spr->w, spr->h, kTexKeyWall + spr->key);
+					return;
+				}
 				const uint8_t *texData = _spriteCache.getData(spr->key, spr->data);
 				if (maskedWall) { // make every 4 pixels transparent
 					const int texSize = spr->h * spr->w;
@@ -3464,10 +3786,9 @@ bool Game::redrawSceneGridCell(int x, int z, CellMap *cell) {
 
 void Game::redrawSceneGroundWalls() {
 	_decorTexture = 0;
-	for (int x = 0; x < kMapSizeX; ++x) {
-		for (int z = 0; z < kMapSizeZ; ++z) {
-			_sceneCellMap[x][z].draw = 0;
-		}
+	CellMap *cellMap = &_sceneCellMap[0][0];
+	for (int i = 0; i < _sceneVisibility.cellsCount; ++i) {
+		cellMap[_sceneVisibility.cells[i]].draw = 0;
 	}
 	rayCastWall(_xPosObserver << 1, _zPosObserver << 1);
 	_render->clearScreen();
@@ -3489,15 +3810,12 @@ void Game::redrawSceneGroundWalls() {
 	}
 	_render->setupProjection(kProjGame);
 	_render->setIgnoreDepth(false);
-	for (int x = 0; x < kMapSizeX; ++x) {
-		for (int z = 0; z < kMapSizeZ; ++z) {
-			CellMap *cell = &_sceneCellMap[x][z];
-			if (cell->draw != 0) {
-				redrawSceneGridCell(x, z, cell);
-			}
-		}
+	for (int i = 0; i < _sceneVisibility.cellsCount; ++i) {
+		const int num = _sceneVisibility.drawCells[i];
+		const int x = num / kMapSizeZ;
+		const int z = num % kMapSizeZ;
+		redrawSceneGridCell(x, z, &_sceneCellMap[x][z]);
 	}
-
 }
 
 bool Game::findRoom(const CollisionSlot *colSlot, int room1, int room2) {
@@ -3995,73 +4313,154 @@ GameObject *Game::findObjectByName(GameObject *o, const char *name) {
 	return 0;
 }
 
-void Game::addParticle(int xPos, int yPos, int zPos, int rnd, int dx, int dy, int dz, int count, int ticks, int fl, int speed) {
-	const int particlesLeft = kParticlesTableSize - _particlesCount;
+int Game::reserveParticles(int count) {
+	const int particlesLeft = _params.particlesMax - _particles.count;
 	if (count > particlesLeft) {
 		count = particlesLeft;
 	}
-	assert(_particlesCount + count <= kParticlesTableSize);
-	for (int i = 0; i < count; ++i) {
-		Particle *part = &_particlesTable[_particlesCount + i];
-		memset(part, 0, sizeof(Particle));
-		part->xPos = xPos;
-		part->yPos = (kGroundY << 15) + yPos;
-		part->zPos = zPos;
-		part->dx = dx + _rnd.getRandomNumberShift(rnd);
-		part->dy = dy - _rnd.getRandomNumberShift(rnd);
-		part->dz = dz + _rnd.getRandomNumberShift(rnd);
-		part->ticks = ticks + (_rnd.getRandomNumber() >> 9);
-		part->fl = fl;
-		part->speed = speed;
+	if (count <= 0) {
+		return 0;
 	}
-	_particlesCount += count;
+	if (_particles.count + count > _particles.size) {
+		// the arrays are kept separate (SoA) for updateParticles()
+		const int size = MIN(MAX(_particles.size * 2, _particles.count + count), _params.particlesMax);
+		int *positions = ALLOC<int>(size * 8);
+		int16_t *ticks = ALLOC<int16_t>(size * 2);
+		bool *isBlob = ALLOC<bool>(size);
+		Vertex *points = ALLOC<Vertex>(size);
+		if (!positions || !ticks || !isBlob || !points) {
+			warning("Game::reserveParticles() unable to allocate %d particles", size);
+			free(positions);
+			free(ticks);
+			free(isBlob);
+			free(points);
+			return MIN(count, _particles.size - _particles.count);
+		}
+		Particles p;
+		p.count = _particles.count;
+		p.size = size;
+		p.xPos = positions;
+		p.yPos = positions + size;
+		p.zPos = positions + size * 2;
+		p.dx = positions + size * 3;
+		p.dy = positions + size * 4;
+		p.dz = positions + size * 5;
+		p.fl = positions + size * 6;
+		p.ticks = ticks;
+		p.speed = ticks + size;
+		p.isBlob = isBlob;
+		p.points = points;
+		p.colors = positions + size * 7;
+		if (_particles.count != 0) {
+			const int n = _particles.count;
+			memcpy(p.xPos, _particles.xPos, n * sizeof(int));
+			memcpy(p.yPos, _particles.yPos, n * sizeof(int));
+			memcpy(p.zPos, _particles.zPos, n * sizeof(int));
+			memcpy(p.dx, _particles.dx, n * sizeof(int));
+			memcpy(p.dy, _particles.dy, n * sizeof(int));
+			memcpy(p.dz, _particles.dz, n * sizeof(int));
+			memcpy(p.fl, _particles.fl, n * sizeof(int));
+			memcpy(p.ticks, _particles.ticks, n * sizeof(int16_t));
+			memcpy(p.speed, _particles.speed, n * sizeof(int16_t));
+			memcpy(p.isBlob, _particles.isBlob, n * sizeof(bool));
+		}
+		if (_particles.size != 0) {
+			debug(kDebug_GAME, "Game::reserveParticles() growing pool to %d", size);
+		}
+		freeParticles();
+		_particles = p;
+	}
+	return count;
+}
+
+void Game::freeParticles() {
+	free(_particles.xPos);
+	free(_particles.ticks);
+	free(_particles.isBlob);
+	free(_particles.points);
+	memset(&_particles, 0, sizeof(_particles));
+}
+
+void Game::addParticle(int xPos, int yPos, int zPos, int rnd, int dx, int dy, int dz, int count, int ticks, int fl, int speed) {
+	count = reserveParticles(count);
+	for (int i = _particles.count; i < _particles.count + count; ++i) {
+		_particles.xPos[i] = xPos;
+		_particles.yPos[i] = (kGroundY << 15) + yPos;
+		_particles.zPos[i] = zPos;
+		_particles.dx[i] = dx + _rnd.getRandomNumberShift(rnd);
+		_particles.dy[i] = dy - _rnd.getRandomNumberShift(rnd);
+		_particles.dz[i] = dz + _rnd.getRandomNumberShift(rnd);
+		_particles.ticks[i] = ticks + (_rnd.getRandomNumber() >> 9);
+		_particles.fl[i] = fl;
+		_particles.speed[i] = speed;
+		_particles.isBlob[i] = false;
+	}
+	_particles.count += count;
 }
 
 void Game::addParticleBlob(SceneObject *so, int xPos, int yPos, int zPos, int rnd, int ticks, int fl) {
-	if (_particlesCount < kParticlesTableSize) {
-		Particle *part = &_particlesTable[_particlesCount];
-		memset(part, 0, sizeof(Particle));
+	if (reserveParticles(1) == 1) {
+		const int i = _particles.count;
 		Vec_xz v(xPos, zPos);
 		v.rotate(so->pitch, 3);
-		part->xPos = v.x + so->x;
-		part->zPos = v.z + so->z;
-		part->yPos = (yPos << 13) + so->y;
-		part->dx =  _rnd.getRandomNumberShift(rnd);
-		part->dy = -_rnd.getRandomNumberShift(rnd);
-		part->dz =  _rnd.getRandomNumberShift(rnd);
-		part->ticks = ticks + (_rnd.getRandomNumber() >> 9);
-		part->fl = fl;
-		part->speed = 0;
-		part->isBlob = true;
-		++_particlesCount;
+		_particles.xPos[i] = v.x + so->x;
+		_particles.zPos[i] = v.z + so->z;
+		_particles.yPos[i] = (yPos << 13) + so->y;
+		_particles.dx[i] =  _rnd.getRandomNumberShift(rnd);
+		_particles.dy[i] = -_rnd.getRandomNumberShift(rnd);
+		_particles.dz[i] =  _rnd.getRandomNumberShift(rnd);
+		_particles.ticks[i] = ticks + (_rnd.getRandomNumber() >> 9);
+		_particles.fl[i] = fl;
+		_particles.speed[i] = 0;
+		_particles.isBlob[i] = true;
+		++_particles.count;
 	}
 }
 
 void Game::updateParticles() {
-	for (int i = 0; i < _particlesCount; ) {
-		Particle *part = &_particlesTable[i];
-		--part->ticks;
-		if (part->ticks <= 0) {
-			--_particlesCount;
-			if (i < _particlesCount) {
-				_particlesTable[i] = _particlesTable[i + 1];
+	// same removal as the original table, the count near the limit changes the random numbers drawn by addParticle()
+	for (int i = 0; i < _particles.count; ) {
+		--_particles.ticks[i];
+		if (_particles.ticks[i] <= 0) {
+			--_particles.count;
+			if (i < _particles.count) {
+				const int j = i + 1;
+				_particles.xPos[i] = _particles.xPos[j];
+				_particles.yPos[i] = _particles.yPos[j];
+				_particles.zPos[i] = _particles.zPos[j];
+				_particles.dx[i] = _particles.dx[j];
+				_particles.dy[i] = _particles.dy[j];
+				_particles.dz[i] = _particles.dz[j];
+				_particles.fl[i] = _particles.fl[j];
+				_particles.ticks[i] = _particles.ticks[j];
+				_particles.speed[i] = _particles.speed[j];
+				_particles.isBlob[i] = _particles.isBlob[j];
 			}
 		} else {
 			++i;
 		}
 	}
-	for (int i = 0; i < _particlesCount; ++i) {
-		Particle *part = &_particlesTable[i];
-		part->dy += 1 << 12;
-		if (part->yPos >= (kGroundY << 15)) {
-			part->yPos = kGroundY << 15;
-			part->dy = (-part->dy) >> 2;
-			part->dx >>= 1;
-			part->dz >>= 1;
-		}
-		part->xPos += part->dx;
-		part->yPos += part->dy;
-		part->zPos += part->dz;
+	const int count = _particles.count;
+	// branchless, the loop can be vectorized by the compiler
+	static const int kGround = kGroundY << 15;
+	int *xPos = _particles.xPos;
+	int *yPos = _particles.yPos;
+	int *zPos = _particles.zPos;
+	int *dx = _particles.dx;
+	int *dy = _particles.dy;
+	int *dz = _particles.dz;
+	for (int i = 0; i < count; ++i) {
+		const bool ground = yPos[i] >= kGround;
+		const int y = ground ? kGround : yPos[i];
+		const int vy = dy[i] + (1 << 12);
+		const int vx = ground ? (dx[i] >> 1) : dx[i];
+		const int vz = ground ? (dz[i] >> 1) : dz[i];
+		dy[i] = ground ? ((-vy) >> 2) : vy;
+		dx[i] = vx;
+		dz[i] = vz;
+		xPos[i] += vx;
+		yPos[i] = y + dy[i];
+		zPos[i] += vz;
 	}
 }
 
@@ -4085,13 +4484,17 @@ static const uint8_t blobTex[16 * 16] = {
 };
 
 void Game::drawParticles() {
-	for (int i = 0; i < _particlesCount; ++i) {
-		Particle *part = &_particlesTable[i];
+	// consecutive points are submitted in a single draw call, the blobs are drawn in between to keep the order
+	Vertex *points = _particles.points;
+	int *colors = _particles.colors;
+	int pointsCount = 0;
+	for (int i = 0; i < _particles.count; ++i) {
+		const int fl = _particles.fl[i];
 		int color;
-		if (part->isBlob) {
+		if (_particles.isBlob[i]) {
 			int clut[4];
 			clut[0] = 0;
-			clut[1] = part->fl & 255;
+			clut[1] = fl & 255;
 			color = clut[1];
 			clut[2] = _indirectPalette[kIndirectColorShadow][color];
 			color = clut[2];
@@ -4108,15 +4511,19 @@ void Game::drawParticles() {
 				v[1].x =  kW; v[1].y = -kW; v[1].z = 0;
 				v[2].x =  kW; v[2].y =  kW; v[2].z = 0;
 				v[3].x = -kW; v[3].y =  kW; v[3].z = 0;
-				_render->beginObjectDraw(part->xPos, part->yPos, part->zPos, _yInvRotObserver, kPosShift);
+				if (pointsCount != 0) {
+					_render->drawParticles(points, colors, pointsCount);
+					pointsCount = 0;
+				}
+				_render->beginObjectDraw(_particles.xPos[i], _particles.yPos[i], _particles.zPos[i], _yInvRotObserver, kPosShift);
 				_render->drawPolygonTexture(v, 4, 0, tmpTex, 16, 16, kTexKeyBlob + clut[1]);
 				_render->endObjectDraw();
 				continue;
 			}
-		} else if (part->fl & 0x8000) {
-			color = _mrkBuffer[254 + (part->fl & 255)];
+		} else if (fl & 0x8000) {
+			color = _mrkBuffer[254 + (fl & 255)];
 		} else {
-			switch (part->fl & 15) {
+			switch (fl & 15) {
 			case 0:
 				color = kFlatColorShadow;
 				break;
@@ -4136,15 +4543,20 @@ void Game::drawParticles() {
 				color = kFlatColorBlue;
 				break;
 			default:
-				warning("Game::drawParticles() Invalid color fl 0x%x", part->fl);
-				return;
+				warning("Game::drawParticles() Invalid color fl 0x%x", fl);
+				i = _particles.count;
+				continue;
 			}
 		}
-		Vertex v;
-		v.x = part->xPos >> kPosShift;
-		v.y = part->yPos >> kPosShift;
-		v.z = part->zPos >> kPosShift;
-		_render->drawParticle(&v, color);
+		Vertex *v = &points[pointsCount];
+		v->x = _particles.xPos[i] >> kPosShift;
+		v->y = _particles.yPos[i] >> kPosShift;
+		v->z = _particles.zPos[i] >> kPosShift;
+		colors[pointsCount] = color;
+		++pointsCount;
+	}
+	if (pointsCount != 0) {
+		_render->drawParticles(points, colors, pointsCount);
 	}
 }
 
@@ -7,8 +7,10 @@
 #define GAME_H__
 
 #include "util.h"
+#include "benchmark.h"
 #include "cutscene.h"
 #include "resource.h"
+#include "meshcache.h"
 #include "sound.h"
 #include "spritecache.h"
 #include "random.h"
@@ -65,6 +67,8 @@ enum {
 	kAniShift = 4,
 	kObjectsDrawListSize = 64,
 	kCollidingObjectsTableSize = 64,
+	kColSlotsPerObject = 8,
+	kColSlotsChunksCount = 16,
 	kCutsceneMessagesTableSize = 128,
 	kSoundKeysTableSize = 10,
 	kScreenWidth = 320,
@@ -172,6 +176,18 @@ struct CellMap {
 	CollisionSlot *colSlot;
 };
 
+struct SceneVisibility {
+	bool valid;
+	int x, z;
+	int cosObserver, sinObserver;
+	uint32_t cellsHash; // type and data of the cells crossed by the rays
+	int decorTexture;
+	int cellsCount;
+	uint16_t cells[kMapSizeX * kMapSizeZ]; // in raycasting order
+	uint8_t cellsDraw[kMapSizeX * kMapSizeZ];
+	uint16_t drawCells[kMapSizeX * kMapSizeZ]; // in map order
+};
+
 struct CameraPosMap {
 	int32_t x, z, ry;
 	int32_t l_ry, r_ry;
@@ -346,13 +362,16 @@ struct GameFollowingObject {
 	GameFollowingPoint points[kFollowingObjectPointsTableSize];
 };
 
-struct Particle {
-	int xPos, yPos, zPos;
-	int dx, dy, dz;
-	int fl;
-	int16_t ticks;
-	int16_t speed;
-	bool isBlob;
+struct Particles {
+	int count, size;
+	int *xPos, *yPos, *zPos;
+	int *dx, *dy, *dz;
+	int *fl;
+	int16_t *ticks;
+	int16_t *speed;
+	bool *isBlob;
+	Vertex *points; // drawParticles() buffers
+	int *colors;
 };
 
 struct Font {
@@ -433,9 +452,32 @@ struct DrawNumber {
 };
 
 struct Render;
+struct Game;
+
+enum {
+	kScriptParam_Immediate,
+	kScriptParam_ObjectData,
+	kScriptParam_ObjectFlag,
+	kScriptParam_Var,
+	kScriptParam_Special // getObjectScriptParam()
+};
+
+struct ScriptInstruction {
+	int (Game::*proc)(int argc, int32_t *argv);
+	uint8_t argc;
+	bool negate;
+	uint8_t paramTypes[8];
+	int32_t argv[8];
+};
+
+struct ScriptCmd {
+	int first; // index in the instructions table, -1 if the command is interpreted
+	int condCount;
+	int stmtCount;
+};
 
 struct GameParams {
-	GameParams() : playDemo(false), levelNum(0), subtitles(false), sf2(0), mouseMode(false), touchMode(false), cheats(0) {}
+	GameParams() : playDemo(false), levelNum(0), subtitles(false), sf2(0), mouseMode(false), touchMode(false), cheats(0), preloadSprites(false), sfxCacheSize(32), cutsceneDecodeAhead(4), particlesMax(kParticlesTableSize), sceneVisibilityCache(true) {}
 	bool playDemo;
 	int levelNum;
 	bool subtitles;
@@ -443,6 +485,11 @@ struct GameParams {
 	bool mouseMode;
 	bool touchMode;
 	uint32_t cheats;
+	bool preloadSprites;
+	int sfxCacheSize; // MB
+	int cutsceneDecodeAhead; // frames
+	int particlesMax;
+	bool sceneVisibilityCache;
 };
 
 struct Game {
@@ -457,7 +504,13 @@ struct Game {
 	Cutscene _cut;
 	Render *_render;
 	GameParams _params;
+	TickStats *_tickStats; // per phase timings, when benchmarking
+	ScriptInstruction *_scriptInstructions; // level .cmd data decoded
+	int _scriptInstructionsCount;
+	ScriptCmd *_scriptCmds;
+	int _scriptCmdsCount;
 	SpriteCache _spriteCache;
+	MeshCache _meshCache;
 	Random _rnd, _rnd2;
 	int _gameStateMsg;
 	bool _musicPaused;
@@ -490,6 +543,11 @@ struct Game {
 	int _objectsCount, _objectsSetupCount;
 	int _objectsDrawCount;
 	GameObject *_objectsDrawList[kObjectsDrawListSize];
+	CollisionSlot *_colSlotsChunks[kColSlotsChunksCount]; // pool, sized from the level objects count
+	int _colSlotsChunksCount;
+	int _colSlotsChunkSize;
+	CollisionSlot *_colSlotsFreeList;
+	int _colSlotsUsed, _colSlotsHighWater;
 	GameObject *_updateGlobalPosRefObject;
 	int _collidingObjectsCount;
 	GameObject *_collidingObjectsTable[kCollidingObjectsTableSize];
@@ -502,6 +560,7 @@ struct Game {
 	int16_t _mapKey;
 	int16_t _palKeysTable[kPalKeysTableSize];
 	CellMap _sceneCellMap[kMapSizeX][kMapSizeZ];
+	SceneVisibility _sceneVisibility;
 	int32_t _sceneGroundMap[kMapSizeX][kMapSizeZ];
 	int _sceneCamerasCount;
 	CameraPosMap _sceneCameraPosTable[256];
@@ -542,8 +601,7 @@ struct Game {
 	int _decorTexture;
 
 	int _particleDx, _particleDy, _particleDz, _particleRnd, _particleSpd;
-	int _particlesCount;
-	Particle _particlesTable[kParticlesTableSize];
+	Particles _particles;
 
 	int _playerMessagesCount;
 	GamePlayerMessage _playerMessagesTable[kPlayerMessagesTableSize];
@@ -602,6 +660,12 @@ struct Game {
 		assert(x >= 0 && x < kMapSizeX && z >= 0 && z < kMapSizeZ);
 		return &_sceneCellMap[x][z];
 	}
+	void setCellMapDraw(CellMap *cell, int flag) {
+		if (cell->draw == 0) {
+			_sceneVisibility.cells[_sceneVisibility.cellsCount++] = cell - &_sceneCellMap[0][0];
+		}
+		cell->draw |= flag;
+	}
 	CellMap *getCellMapShr19(int x, int z) {
 		return getCellMap(x >> (4 + kPosShift), z >> (4 + kPosShift));
 	}
@@ -665,6 +729,10 @@ struct Game {
 	void updateSceneAnimations();
 	void getSceneTexture(int16_t key, int framesSkip, SpriteImage *spr);
 	void loadSceneTextures(int16_t key);
+	void addToSceneTexturesAtlas(int16_t aniKey);
+	void loadSceneTexturesAtlas();
+	void queueSceneSprites(int16_t aniKey);
+	void preloadSceneSprites();
 	void updateSceneTextures();
 	void initScene();
 	void init();
@@ -679,6 +747,11 @@ struct Game {
 	int32_t getObjectData(GameObject *o, int field);
 	int32_t getObjectScriptParam(GameObject *o, int field);
 	int executeObjectScriptOpcode(GameObject *o, uint32_t op, const uint8_t *&data);
+	bool compileObjectScriptOpcode(uint32_t op, const uint8_t *&data, ScriptInstruction *ins);
+	void compileObjectScripts();
+	void freeObjectScripts();
+	int executeScriptInstruction(GameObject *o, const ScriptInstruction *ins);
+	int executeScriptCmd(GameObject *o, int num);
 	uint8_t *getStartScriptAnim();
 	uint8_t *getNextScriptAnim();
 	int executeObjectScript(GameObject *o);
@@ -724,6 +797,8 @@ struct Game {
 	void saveInventoryObjects();
 	void loadInventoryObjects();
 	GameObject *findObjectByName(GameObject *o, const char *name);
+	int reserveParticles(int count);
+	void freeParticles();
 	void addParticle(int xPos, int yPos, int zPos, int rnd, int dx, int dy, int dz, int count, int ticks, int fl, int speed);
 	void addParticleBlob(SceneObject *so, int xPos, int yPos, int zPos, int rnd, int ticks, int fl);
 	void updateParticles();
@@ -761,6 +836,11 @@ struct Game {
 	int getCameraAngle(int viewpointx, int viewpointz, int viewpointry, int *retx, int *retz, int *retry);
 
 	// collision.cpp
+	void initCollisionSlotsPool(int objectsCount);
+	void freeCollisionSlotsPool();
+	void resetCollisionSlotsPool();
+	CollisionSlot *allocCollisionSlot();
+	void freeCollisionSlot(CollisionSlot *colSlot);
 	CollisionSlot *createCollisionSlot(CollisionSlot *prev, CollisionSlot *next, GameObject *o, CellMap *cell);
 	void destroyCollisionSlot(CellMap *cell);
 	bool collisionSlotCb1(CellMap *cellMap);
@@ -909,6 +989,8 @@ struct Game {
 	int rayCast(GameObject *o, int x, RayCastCallbackType callback, int type);
 	int rayCastMono(GameObject *o, int x, CellMap *cellMap, RayCastCallbackType callback, int delta);
 	int rayCastCamera(GameObject *o, int x, CellMap *cellMap, RayCastCallbackType callback);
+	uint32_t getSceneVisibilityHash() const;
+	bool replaySceneVisibility(int x, int z);
 	void rayCastWall(int x, int z);
 
 	// saveload.cpp
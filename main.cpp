@@ -27,6 +27,7 @@ static int gScale = 2;
 static int gSaveSlot = 1;
 
 static const int kTickDuration = 50;
+static const int kTicksCatchUpMax = 5;
 
 static const char *kControlsCfg = "controls.cfg";
 
@@ -246,6 +247,64 @@ static void setupAudio(GameStub *stub) {
 	}
 }
 
+static void nullLockAudio(int lock) {
+}
+
+static int runBenchmark(GameStub *stub) {
+	// offscreen GL context (EGL pbuffer), no display server, audio device or frame pacing : the ticks run back to back
+	SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+		fprintf(stderr, "Unable to initialize offscreen video, %s\n", SDL_GetError());
+		return -1;
+	}
+	SDL_Window *window = SDL_CreateWindow(g_caption, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, kDefaultW, kDefaultH, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (!window) {
+		fprintf(stderr, "Unable to create benchmark window, %s\n", SDL_GetError());
+		SDL_Quit();
+		return -1;
+	}
+	// the renderer needs a current GL context, even if nothing is displayed
+	SDL_GLContext glcontext = SDL_GL_CreateContext(window);
+	if (!glcontext) {
+		fprintf(stderr, "Unable to create benchmark GL context, %s\n", SDL_GetError());
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return -1;
+	}
+	SDL_GL_SetSwapInterval(0);
+	int ret = stub->init();
+	if (ret != 0) {
+		SDL_GL_DeleteContext(glcontext);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return ret;
+	}
+	StubMixProc mix = stub->getMixProc(22050, AUDIO_S16SYS, nullLockAudio);
+	static const int kMixBufferSize = 22050 * kTickDuration / 1000 * 2 * sizeof(int16_t);
+	uint8_t *mixBuffer = (uint8_t *)malloc(kMixBufferSize);
+	_aspectRatio[0] = 0.;
+	_aspectRatio[1] = 0.;
+	_aspectRatio[2] = 1.;
+	_aspectRatio[3] = 1.;
+	stub->initGL(kDefaultW, kDefaultH, _aspectRatio);
+	unsigned int ticks = 0;
+	do {
+		stub->doTick(ticks);
+		stub->drawGL(256);
+		if (mix.proc && mixBuffer) {
+			// consume the sound data as the audio callback would
+			mix.proc(mix.data, mixBuffer, kMixBufferSize);
+		}
+		ticks += kTickDuration;
+	} while (!stub->isBenchmarkDone());
+	free(mixBuffer);
+	stub->quit();
+	SDL_GL_DeleteContext(glcontext);
+	SDL_DestroyWindow(window);
+	SDL_Quit();
+	return 0;
+}
+
 static void setAspectRatio(int w, int h) {
 	const float currentAspectRatio = w / (float)h;
 	// pillar box
@@ -285,6 +344,9 @@ int main(int argc, char *argv[]) {
 	if (ret != 0) {
 		return ret;
 	}
+	if (stub->isBenchmark()) {
+		return runBenchmark(stub);
+	}
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_JOYSTICK | SDL_INIT_GAMECONTROLLER | SDL_INIT_HAPTIC);
 	SDL_ShowCursor(stub->hasCursor() ? SDL_ENABLE : SDL_DISABLE);
 	bool widescreen = false;
@@ -354,6 +416,8 @@ int main(int argc, char *argv[]) {
 	stub->initGL(gWindowW, gWindowH, _aspectRatio);
 	bool quitGame = false;
 	bool paused = false;
+	const bool interpolation = stub->hasInterpolation();
+	uint32_t nextGameTick = SDL_GetTicks();
 	while (1) {
 		int w = gWindowW;
 		int h = gWindowH;
@@ -527,10 +591,32 @@ int main(int argc, char *argv[]) {
 			SDL_SetWindowSize(window, gWindowW, gWindowH);
 			stub->initGL(gWindowW, gWindowH, _aspectRatio);
 		}
-		if (!paused) {
+		if (!paused && interpolation) {
+			// fixed rate game ticks, the frames are drawn at the display rate
+			const uint32_t now = SDL_GetTicks();
+			if ((int)(now - nextGameTick) >= kTickDuration * kTicksCatchUpMax) {
+				nextGameTick = now;
+			}
+			while ((int)(now - nextGameTick) >= 0) {
+				stub->doTick(nextGameTick);
+				nextGameTick += kTickDuration;
+			}
+			const int alpha = (int)(now + kTickDuration - nextGameTick) * 256 / kTickDuration;
+			stub->drawGL(alpha);
+			SDL_GL_SwapWindow(window);
+			if (stub->shouldVibrate()) {
+				if (haptic) {
+					SDL_HapticRumbleInit(haptic);
+					SDL_HapticRumblePlay(haptic, 1., 500);
+				}
+			}
+			if (SDL_GL_GetSwapInterval() == 0) {
+				SDL_Delay(1);
+			}
+		} else if (!paused) {
 			const unsigned int ticks = SDL_GetTicks();
 			stub->doTick(ticks);
-			stub->drawGL();
+			stub->drawGL(256);
 			SDL_GL_SwapWindow(window);
 			if (stub->shouldVibrate()) {
 				if (haptic) {
@@ -542,6 +628,7 @@ int main(int argc, char *argv[]) {
 			SDL_Delay(delayTick < 16 ? 16 : delayTick);
 		} else {
 			SDL_Delay(kTickDuration);
+			nextGameTick = SDL_GetTicks();
 		}
 	}
 	SDL_PauseAudio(1);
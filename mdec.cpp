@@ -3,6 +3,14 @@
 #include "mdec.h"
 #include "mdec_coeffs.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MDEC_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MDEC_NEON
+#endif
+
 struct BitStream { // most significant 16 bits
 	const uint8_t *_src;
 	uint32_t _bits;
@@ -174,19 +182,170 @@ static void idct(float *dequantData, float *result) {
 	}
 }
 
-static void decodeBlock(BitStream *bs, int x8, int y8, uint8_t *dst, int dstPitch, int scale, int version, bool luma, int *prevDC) {
+// fixed point version of the islow IDCT (Loeffler, Ligtenberg and Moschytz)
+
+enum {
+	kIdctConstBits = 13,
+	kIdctPass1Bits = 2,
+	kIdctInputBits = 1 // dequantized coefficients keep one fractional bit
+};
+
+#define FIX_0_298631336  2446
+#define FIX_0_390180644  3196
+#define FIX_0_541196100  4433
+#define FIX_0_765366865  6270
+#define FIX_0_899976223  7373
+#define FIX_1_175875602  9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+#define DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
+static void dequantizeBlockInt(const int *coefficients, int *block, int scale) {
+	block[0] = coefficients[0] * _quantizationTable[0] * (1 << kIdctInputBits); // DC
+	for (int i = 1; i < 8 * 8; i++) {
+		block[i] = DESCALE(coefficients[_zigZagTable[i]] * _quantizationTable[i] * scale, 3 - kIdctInputBits);
+	}
+}
+
+static void idctInt(const int *in, uint8_t *dst, int dstPitch) {
+	int ws[8 * 8];
+	// 1D IDCT columns
+	for (int x = 0; x < 8; ++x) {
+		const int *p = in + x;
+		int *q = ws + x;
+		if ((p[8] | p[16] | p[24] | p[32] | p[40] | p[48] | p[56]) == 0) {
+			const int dc = p[0] << kIdctPass1Bits;
+			for (int i = 0; i < 8; ++i) {
+				q[i * 8] = dc;
+			}
+			continue;
+		}
+		int z2 = p[16];
+		int z3 = p[48];
+		int z1 = (z2 + z3) * FIX_0_541196100;
+		int tmp2 = z1 - z3 * FIX_1_847759065;
+		int tmp3 = z1 + z2 * FIX_0_765366865;
+		int tmp0 = (p[0] + p[32]) << kIdctConstBits;
+		int tmp1 = (p[0] - p[32]) << kIdctConstBits;
+		const int tmp10 = tmp0 + tmp3;
+		const int tmp13 = tmp0 - tmp3;
+		const int tmp11 = tmp1 + tmp2;
+		const int tmp12 = tmp1 - tmp2;
+		tmp0 = p[56];
+		tmp1 = p[40];
+		tmp2 = p[24];
+		tmp3 = p[8];
+		z1 = tmp0 + tmp3;
+		z2 = tmp1 + tmp2;
+		z3 = tmp0 + tmp2;
+		int z4 = tmp1 + tmp3;
+		const int z5 = (z3 + z4) * FIX_1_175875602;
+		tmp0 *= FIX_0_298631336;
+		tmp1 *= FIX_2_053119869;
+		tmp2 *= FIX_3_072711026;
+		tmp3 *= FIX_1_501321110;
+		z1 *= -FIX_0_899976223;
+		z2 *= -FIX_2_562915447;
+		z3 = z3 * -FIX_1_961570560 + z5;
+		z4 = z4 * -FIX_0_390180644 + z5;
+		tmp0 += z1 + z3;
+		tmp1 += z2 + z4;
+		tmp2 += z2 + z3;
+		tmp3 += z1 + z4;
+		static const int kShift = kIdctConstBits - kIdctPass1Bits;
+		q[0]  = DESCALE(tmp10 + tmp3, kShift);
+		q[56] = DESCALE(tmp10 - tmp3, kShift);
+		q[8]  = DESCALE(tmp11 + tmp2, kShift);
+		q[48] = DESCALE(tmp11 - tmp2, kShift);
+		q[16] = DESCALE(tmp12 + tmp1, kShift);
+		q[40] = DESCALE(tmp12 - tmp1, kShift);
+		q[24] = DESCALE(tmp13 + tmp0, kShift);
+		q[32] = DESCALE(tmp13 - tmp0, kShift);
+	}
+	// 1D IDCT rows, the output is in the (-128,127) range
+	static const int kShift = kIdctConstBits + kIdctPass1Bits + 3 + kIdctInputBits;
+	for (int y = 0; y < 8; ++y) {
+		const int *p = ws + y * 8;
+		if ((p[1] | p[2] | p[3] | p[4] | p[5] | p[6] | p[7]) == 0) {
+			const int dc = DESCALE(p[0], kIdctPass1Bits + 3 + kIdctInputBits) + 128;
+			memset(dst, CLIP(dc, 0, 255), 8);
+			dst += dstPitch;
+			continue;
+		}
+		int z2 = p[2];
+		int z3 = p[6];
+		int z1 = (z2 + z3) * FIX_0_541196100;
+		int tmp2 = z1 - z3 * FIX_1_847759065;
+		int tmp3 = z1 + z2 * FIX_0_765366865;
+		int tmp0 = (p[0] + p[4]) << kIdctConstBits;
+		int tmp1 = (p[0] - p[4]) << kIdctConstBits;
+		const int tmp10 = tmp0 + tmp3;
+		const int tmp13 = tmp0 - tmp3;
+		const int tmp11 = tmp1 + tmp2;
+		const int tmp12 = tmp1 - tmp2;
+		tmp0 = p[7];
+		tmp1 = p[5];
+		tmp2 = p[3];
+		tmp3 = p[1];
+		z1 = tmp0 + tmp3;
+		z2 = tmp1 + tmp2;
+		z3 = tmp0 + tmp2;
+		int z4 = tmp1 + tmp3;
+		const int z5 = (z3 + z4) * FIX_1_175875602;
+		tmp0 *= FIX_0_298631336;
+		tmp1 *= FIX_2_053119869;
+		tmp2 *= FIX_3_072711026;
+		tmp3 *= FIX_1_501321110;
+		z1 *= -FIX_0_899976223;
+		z2 *= -FIX_2_562915447;
+		z3 = z3 * -FIX_1_961570560 + z5;
+		z4 = z4 * -FIX_0_390180644 + z5;
+		tmp0 += z1 + z3;
+		tmp1 += z2 + z4;
+		tmp2 += z2 + z3;
+		tmp3 += z1 + z4;
+		const int out[8] = {
+			DESCALE(tmp10 + tmp3, kShift),
+			DESCALE(tmp11 + tmp2, kShift),
+			DESCALE(tmp12 + tmp1, kShift),
+			DESCALE(tmp13 + tmp0, kShift),
+			DESCALE(tmp13 - tmp0, kShift),
+			DESCALE(tmp12 - tmp1, kShift),
+			DESCALE(tmp11 - tmp2, kShift),
+			DESCALE(tmp10 - tmp3, kShift)
+		};
+		for (int x = 0; x < 8; ++x) {
+			dst[x] = CLIP(out[x] + 128, 0, 255);
+		}
+		dst += dstPitch;
+	}
+}
+
+static void decodeBlock(BitStream *bs, int x8, int y8, uint8_t *dst, int dstPitch, int scale, int version, bool luma, int *prevDC, bool referenceIdct) {
 	int coefficients[8 * 8];
 	memset(coefficients, 0, sizeof(coefficients));
 	coefficients[0] = readDC(bs, version, luma ? _dcLumaHuffTree : _dcChromaHuffTree, prevDC);
 	readAC(bs, &coefficients[1]);
 
+	dst += (y8 * dstPitch + x8) * 8;
+	if (!referenceIdct) {
+		int dequantData[8 * 8];
+		dequantizeBlockInt(coefficients, dequantData, scale);
+		idctInt(dequantData, dst, dstPitch);
+		return;
+	}
+
 	float dequantData[8 * 8];
 	dequantizeBlock(coefficients, dequantData, scale);
 
 	float idctData[8 * 8];
 	idct(dequantData, idctData);
 
-	dst += (y8 * dstPitch + x8) * 8;
 	for (int y = 0; y < 8; y++) {
 		for (int x = 0; x < 8; x++) {
 			const int val = (int)round(idctData[y * 8 + x]); // (-128,127) range
@@ -202,7 +361,7 @@ enum {
 	kOutputPlaneCr = 2
 };
 
-int decodeMDEC(const uint8_t *src, int len, int w, int h, void *userdata, void (*output)(const MdecOutput *, void *)) {
+int decodeMDEC(const uint8_t *src, int len, int w, int h, void *userdata, void (*output)(const MdecOutput *, void *), bool referenceIdct) {
 	BitStream bs(src, len);
 	bs.getBits(16);
 	const uint16_t vlc = bs.getBits(16);
@@ -230,12 +389,12 @@ int decodeMDEC(const uint8_t *src, int len, int w, int h, void *userdata, void (
 
 	for (int x = 0; x < blockW; ++x) {
 		for (int y = 0; y < blockH; ++y) {
-			decodeBlock(&bs, x, y, mdecOut.planes[kOutputPlaneCr].ptr, mdecOut.planes[kOutputPlaneCr].pitch, qscale, version, false, &prevDC[kOutputPlaneCr]);
-			decodeBlock(&bs, x, y, mdecOut.planes[kOutputPlaneCb].ptr, mdecOut.planes[kOutputPlaneCb].pitch, qscale, version, false, &prevDC[kOutputPlaneCb]);
-			decodeBlock(&bs, 2 * x,     2 * y,     mdecOut.planes[kOutputPlaneY].ptr, mdecOut.planes[kOutputPlaneY].pitch, qscale, version, true, &prevDC[kOutputPlaneY]);
-			decodeBlock(&bs, 2 * x + 1, 2 * y,     mdecOut.planes[kOutputPlaneY].ptr, mdecOut.planes[kOutputPlaneY].pitch, qscale, version, true, &prevDC[kOutputPlaneY]);
-			decodeBlock(&bs, 2 * x,     2 * y + 1, mdecOut.planes[kOutputPlaneY].ptr, mdecOut.planes[kOutputPlaneY].pitch, qscale, version, true, &prevDC[kOutputPlaneY]);
-			decodeBlock(&bs, 2 * x + 1, 2 * y + 1, mdecOut.planes[kOutputPlaneY].ptr, mdecOut.planes[kOutputPlaneY].pitch, qscale, version, true, &prevDC[kOutputPlaneY]);
+			decodeBlock(&bs, x, y, mdecOut.planes[kOutputPlaneCr].ptr, mdecOut.planes[kOutputPlaneCr].pitch, qscale, version, false, &prevDC[kOutputPlaneCr], referenceIdct);
+			decodeBlock(&bs, x, y, mdecOut.planes[kOutputPlaneCb].ptr, mdecOut.planes[kOutputPlaneCb].pitch, qscale, version, false, &prevDC[kOutputPlaneCb], referenceIdct);
+			decodeBlock(&bs, 2 * x,     2 * y,     mdecOut.planes[kOutputPlaneY].ptr, mdecOut.planes[kOutputPlaneY].pitch, qscale, version, true, &prevDC[kOutputPlaneY], referenceIdct);
+			decodeBlock(&bs, 2 * x + 1, 2 * y,     mdecOut.planes[kOutputPlaneY].ptr, mdecOut.planes[kOutputPlaneY].pitch, qscale, version, true, &prevDC[kOutputPlaneY], referenceIdct);
+			decodeBlock(&bs, 2 * x,     2 * y + 1, mdecOut.planes[kOutputPlaneY].ptr, mdecOut.planes[kOutputPlaneY].pitch, qscale, version, true, &prevDC[kOutputPlaneY], referenceIdct);
+			decodeBlock(&bs, 2 * x + 1, 2 * y + 1, mdecOut.planes[kOutputPlaneY].ptr, mdecOut.planes[kOutputPlaneY].pitch, qscale, version, true, &prevDC[kOutputPlaneY], referenceIdct);
 		}
 	}
 
@@ -247,3 +406,110 @@ int decodeMDEC(const uint8_t *src, int len, int w, int h, void *userdata, void (
 
 	return 0;
 }
+
+// fixed point BT.601 coefficients, 7 bits : 1.402, 0.344, 0.714, 1.772
+enum {
+	kYuvCrR = 179,
+	kYuvCbG = 44,
+	kYuvCrG = 91,
+	kYuvCbB = 227
+};
+
+static inline uint32_t yuvToRgba(int y, int u, int v) {
+	const int r = CLIP(y + ((kYuvCrR * v + 64) >> 7), 0, 255);
+	const int g = CLIP(y - ((kYuvCbG * u + kYuvCrG * v + 64) >> 7), 0, 255);
+	const int b = CLIP(y + ((kYuvCbB * u + 64) >> 7), 0, 255);
+	return 0xFF000000 | (b << 16) | (g << 8) | r;
+}
+
+#if defined(MDEC_SSE2)
+
+static void convertRow16(uint32_t *dst, const uint8_t *luma, const uint8_t *cb, const uint8_t *cr) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i rnd = _mm_set1_epi16(64);
+	const __m128i u = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)cb), zero), bias);
+	const __m128i v = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)cr), zero), bias);
+	const __m128i rv = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(kYuvCrR)), rnd), 7);
+	const __m128i guv = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(kYuvCbG)), _mm_mullo_epi16(v, _mm_set1_epi16(kYuvCrG))), rnd), 7);
+	const __m128i bu = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(kYuvCbB)), rnd), 7);
+	// each chroma sample covers two pixels
+	const __m128i y8 = _mm_loadu_si128((const __m128i *)luma);
+	const __m128i yLo = _mm_unpacklo_epi8(y8, zero);
+	const __m128i yHi = _mm_unpackhi_epi8(y8, zero);
+	const __m128i r = _mm_packus_epi16(_mm_add_epi16(yLo, _mm_unpacklo_epi16(rv, rv)), _mm_add_epi16(yHi, _mm_unpackhi_epi16(rv, rv)));
+	const __m128i g = _mm_packus_epi16(_mm_sub_epi16(yLo, _mm_unpacklo_epi16(guv, guv)), _mm_sub_epi16(yHi, _mm_unpackhi_epi16(guv, guv)));
+	const __m128i b = _mm_packus_epi16(_mm_add_epi16(yLo, _mm_unpacklo_epi16(bu, bu)), _mm_add_epi16(yHi, _mm_unpackhi_epi16(bu, bu)));
+	const __m128i a = _mm_set1_epi8((char)0xFF);
+	const __m128i rgLo = _mm_unpacklo_epi8(r, g);
+	const __m128i rgHi = _mm_unpackhi_epi8(r, g);
+	const __m128i baLo = _mm_unpacklo_epi8(b, a);
+	const __m128i baHi = _mm_unpackhi_epi8(b, a);
+	_mm_storeu_si128((__m128i *)(dst),      _mm_unpacklo_epi16(rgLo, baLo));
+	_mm_storeu_si128((__m128i *)(dst + 4),  _mm_unpackhi_epi16(rgLo, baLo));
+	_mm_storeu_si128((__m128i *)(dst + 8),  _mm_unpacklo_epi16(rgHi, baHi));
+	_mm_storeu_si128((__m128i *)(dst + 12), _mm_unpackhi_epi16(rgHi, baHi));
+}
+
+#elif defined(MDEC_NEON)
+
+static void convertRow16(uint32_t *dst, const uint8_t *luma, const uint8_t *cb, const uint8_t *cr) {
+	const uint8x8_t bias = vdup_n_u8(128);
+	const int16x8_t u = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(cb), bias));
+	const int16x8_t v = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(cr), bias));
+	const int16x8_t r = vrshrq_n_s16(vmulq_n_s16(v, kYuvCrR), 7);
+	const int16x8_t g = vrshrq_n_s16(vmlaq_n_s16(vmulq_n_s16(u, kYuvCbG), v, kYuvCrG), 7);
+	const int16x8_t b = vrshrq_n_s16(vmulq_n_s16(u, kYuvCbB), 7);
+	// each chroma sample covers two pixels
+	const int16x8x2_t rv = vzipq_s16(r, r);
+	const int16x8x2_t guv = vzipq_s16(g, g);
+	const int16x8x2_t bu = vzipq_s16(b, b);
+	const uint8x16_t y8 = vld1q_u8(luma);
+	const int16x8_t yLo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y8)));
+	const int16x8_t yHi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y8)));
+	uint8x16x4_t rgba;
+	rgba.val[0] = vcombine_u8(vqmovun_s16(vaddq_s16(yLo, rv.val[0])), vqmovun_s16(vaddq_s16(yHi, rv.val[1])));
+	rgba.val[1] = vcombine_u8(vqmovun_s16(vsubq_s16(yLo, guv.val[0])), vqmovun_s16(vsubq_s16(yHi, guv.val[1])));
+	rgba.val[2] = vcombine_u8(vqmovun_s16(vaddq_s16(yLo, bu.val[0])), vqmovun_s16(vaddq_s16(yHi, bu.val[1])));
+	rgba.val[3] = vdupq_n_u8(255);
+	vst4q_u8((uint8_t *)dst, rgba);
+}
+
+#else
+
+static void convertRow16(uint32_t *dst, const uint8_t *luma, const uint8_t *cb, const uint8_t *cr) {
+	for (int x = 0; x < 16; ++x) {
+		dst[x] = yuvToRgba(luma[x], cb[x / 2] - 128, cr[x / 2] - 128);
+	}
+}
+
+#endif
+
+static void convertMacroblock(const MdecOutput *output, int mbX, int mbY, uint32_t *dst, int dstPitch, int w, int h) {
+	const uint8_t *luma = output->planes[kOutputPlaneY].ptr + mbY * 16 * output->planes[kOutputPlaneY].pitch + mbX * 16;
+	const uint8_t *cb = output->planes[kOutputPlaneCb].ptr + mbY * 8 * output->planes[kOutputPlaneCb].pitch + mbX * 8;
+	const uint8_t *cr = output->planes[kOutputPlaneCr].ptr + mbY * 8 * output->planes[kOutputPlaneCr].pitch + mbX * 8;
+	for (int y = 0; y < h; ++y) {
+		if (w == 16) {
+			convertRow16(dst, luma, cb, cr);
+		} else {
+			for (int x = 0; x < w; ++x) {
+				dst[x] = yuvToRgba(luma[x], cb[x / 2] - 128, cr[x / 2] - 128);
+			}
+		}
+		dst += dstPitch;
+		luma += output->planes[kOutputPlaneY].pitch;
+		cb += output->planes[kOutputPlaneCb].pitch * (y & 1);
+		cr += output->planes[kOutputPlaneCr].pitch * (y & 1);
+	}
+}
+
+void convertMdecToRgba(const MdecOutput *output, uint32_t *dst, int dstPitch, int w, int h) {
+	for (int mbY = 0; mbY * 16 < h; ++mbY) {
+		const int mbH = MIN(h - mbY * 16, 16);
+		for (int mbX = 0; mbX * 16 < w; ++mbX) {
+			const int mbW = MIN(w - mbX * 16, 16);
+			convertMacroblock(output, mbX, mbY, dst + mbY * 16 * dstPitch + mbX * 16, dstPitch, mbW, mbH);
+		}
+	}
+}
@@ -12,6 +12,8 @@ struct MdecOutput {
 	} planes[3];
 };
 
-int decodeMDEC(const uint8_t *src, int len, int w, int h, void *userdata, void (*output)(const struct MdecOutput *, void *));
+int decodeMDEC(const uint8_t *src, int len, int w, int h, void *userdata, void (*output)(const struct MdecOutput *, void *), bool referenceIdct = false);
+// dstPitch is in pixels and can be negative for a bottom-up buffer
+void convertMdecToRgba(const MdecOutput *output, uint32_t *dst, int dstPitch, int w, int h);
 
 #endif // MDEC_H__
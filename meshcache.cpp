@@ -0,0 +1,148 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "meshcache.h"
+
+MeshCache::MeshCache() {
+	_entries = 0;
+	_entriesSize = _entriesCount = 0;
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+MeshCache::~MeshCache() {
+	flush();
+}
+
+void MeshCache::flush() {
+	if (_stats.decodes != 0) {
+		debug(kDebug_RESOURCE, "MeshCache::flush() hits %d decodes %d data %d", _stats.hits, _stats.decodes, _stats.dataSize);
+	}
+	for (int i = 0; i < _entriesSize; ++i) {
+		free((void *)_entries[i].mesh.polygons);
+	}
+	free(_entries);
+	_entries = 0;
+	_entriesSize = _entriesCount = 0;
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+static uint32_t hashMesh(const uint8_t *polygonsData, const uint8_t *verticesData) {
+	const uintptr_t key = (uintptr_t)polygonsData ^ ((uintptr_t)verticesData * 31);
+	return (uint32_t)((key >> 2) * 2654435761U);
+}
+
+bool MeshCache::grow() {
+	const int size = _entriesSize == 0 ? 256 : _entriesSize * 2;
+	Entry *entries = (Entry *)calloc(size, sizeof(Entry));
+	if (!entries) {
+		return false;
+	}
+	for (int i = 0; i < _entriesSize; ++i) {
+		if (_entries[i].polygonsData) {
+			uint32_t index = hashMesh(_entries[i].polygonsData, _entries[i].verticesData) & (size - 1);
+			while (entries[index].polygonsData) {
+				index = (index + 1) & (size - 1);
+			}
+			entries[index] = _entries[i];
+		}
+	}
+	free(_entries);
+	_entries = entries;
+	_entriesSize = size;
+	return true;
+}
+
+static bool decodeMesh(const uint8_t *polygonsData, const uint8_t *verticesData, int verticesCount, Mesh *mesh) {
+	if (polygonsData[0] & 0x80) {
+		const int shadowPolySize = -(int8_t)polygonsData[0];
+		polygonsData += shadowPolySize;
+	}
+	// count the polygons and points first, both arrays are allocated in a single block
+	int polygonsCount = 0;
+	int pointsCount = 0;
+	const uint8_t *p = polygonsData;
+	int count = *p++;
+	while (count != 0) {
+		const int indexSize = (count & 0x40) != 0 ? 1 : 2;
+		count = (count & 15) + 1;
+		p += 2 + count * indexSize;
+		++polygonsCount;
+		pointsCount += count;
+		count = *p++;
+	}
+	const int pointsOffset = (polygonsCount * sizeof(MeshPolygon) + 15) & ~15;
+	uint8_t *data = (uint8_t *)malloc(pointsOffset + pointsCount * sizeof(Vertex));
+	if (!data) {
+		return false;
+	}
+	MeshPolygon *polygons = (MeshPolygon *)data;
+	Vertex *points = (Vertex *)(data + pointsOffset);
+	mesh->polygons = polygons;
+	mesh->points = points;
+	mesh->polygonsCount = 0;
+	p = polygonsData;
+	count = *p++;
+	while (count != 0) {
+		const int color = READ_LE_UINT16(p); p += 2;
+		const bool byteIndex = (count & 0x40) != 0;
+		count = (count & 15) + 1;
+		for (int i = 0; i < count; ++i) {
+			int index;
+			if (byteIndex) {
+				index = *p++;
+				if (index >= verticesCount) {
+					warning("decodeMesh() invalid index %d in vertex buffer (size %d)", index, verticesCount);
+					return true;
+				}
+			} else {
+				index = READ_LE_UINT16(p); p += 2;
+				assert(index < verticesCount);
+			}
+			points[i] = READ_VERTEX32(verticesData + index * 4);
+		}
+		polygons[mesh->polygonsCount].color = color;
+		polygons[mesh->polygonsCount].count = count;
+		++mesh->polygonsCount;
+		points += count;
+		count = *p++;
+	}
+	return true;
+}
+
+const Mesh *MeshCache::getMesh(const uint8_t *polygonsData, const uint8_t *verticesData, int verticesCount) {
+	if (_entriesSize != 0) {
+		uint32_t index = hashMesh(polygonsData, verticesData) & (_entriesSize - 1);
+		while (_entries[index].polygonsData) {
+			if (_entries[index].polygonsData == polygonsData && _entries[index].verticesData == verticesData) {
+				++_stats.hits;
+				return &_entries[index].mesh;
+			}
+			index = (index + 1) & (_entriesSize - 1);
+		}
+	}
+	// keep the table at most half full
+	if (_entriesCount * 2 >= _entriesSize && !grow()) {
+		return 0;
+	}
+	uint32_t index = hashMesh(polygonsData, verticesData) & (_entriesSize - 1);
+	while (_entries[index].polygonsData) {
+		index = (index + 1) & (_entriesSize - 1);
+	}
+	Entry *e = &_entries[index];
+	if (!decodeMesh(polygonsData, verticesData, verticesCount, &e->mesh)) {
+		warning("MeshCache::getMesh() unable to allocate mesh");
+		return 0;
+	}
+	e->polygonsData = polygonsData;
+	e->verticesData = verticesData;
+	++_entriesCount;
+	++_stats.decodes;
+	const Vertex *end = e->mesh.points;
+	for (int i = 0; i < e->mesh.polygonsCount; ++i) {
+		end += e->mesh.polygons[i].count;
+	}
+	_stats.dataSize += (const uint8_t *)end - (const uint8_t *)e->mesh.polygons;
+	return &e->mesh;
+}
@@ -0,0 +1,48 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef MESHCACHE_H__
+#define MESHCACHE_H__
+
+#include "util.h"
+
+struct MeshPolygon {
+	uint16_t color;
+	uint8_t count; // number of points
+};
+
+struct Mesh {
+	int polygonsCount;
+	const MeshPolygon *polygons;
+	const Vertex *points; // polygons points, in drawing order
+};
+
+struct MeshCacheStats {
+	int hits;
+	int decodes; // mesh frames decoded when first drawn
+	int dataSize;
+};
+
+struct MeshCache {
+	struct Entry {
+		const uint8_t *polygonsData;
+		const uint8_t *verticesData;
+		Mesh mesh;
+	};
+	Entry *_entries;
+	int _entriesSize; // power of two
+	int _entriesCount;
+	MeshCacheStats _stats;
+
+	MeshCache();
+	~MeshCache();
+
+	void flush();
+
+	const Mesh *getMesh(const uint8_t *polygonsData, const uint8_t *verticesData, int verticesCount);
+	bool grow();
+};
+
+#endif // MESHCACHE_H__
@@ -3,11 +3,21 @@
  * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include "benchmark.h"
 #include "file.h"
 #include "mixer.h"
 #include "render.h"
+#include "trace.h"
 #include "xmiplayer.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MIXER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIXER_NEON
+#endif
+
 static const int16_t _delta16Table[128] = {
 	    0,      1,      2,      3,      4,      5,      6,      7,
 	    8,      9,     10,     11,     12,     13,     14,     15,
@@ -273,6 +283,95 @@ static void mix(int16_t *dst, int pcm, int volume) {
 	*dst = clipS16(pcm);
 }
 
+// reference, each sound is clipped when added
+static void mixMonoToStereoRef(int16_t *dst, const int16_t *src, int count, int volumeL, int volumeR) {
+	for (int i = 0; i < count; ++i) {
+		mix(&dst[i * 2 + 0], src[i], volumeL);
+		mix(&dst[i * 2 + 1], src[i], volumeR);
+	}
+}
+
+#if defined(MIXER_SSE2)
+// exact truncated division by 127, n is in the [-32768*127,32767*127] range
+static inline __m128i div127(__m128i n) {
+	const __m128i sign = _mm_srai_epi32(n, 31);
+	const __m128i a = _mm_sub_epi32(_mm_xor_si128(n, sign), sign);
+	__m128i q = _mm_add_epi32(_mm_add_epi32(a, _mm_srli_epi32(a, 7)), _mm_add_epi32(_mm_srli_epi32(a, 14), _mm_set1_epi32(1)));
+	q = _mm_srli_epi32(q, 7);
+	// q is a/127 or a/127 - 1
+	const __m128i r = _mm_sub_epi32(a, _mm_sub_epi32(_mm_slli_epi32(q, 7), q));
+	q = _mm_sub_epi32(q, _mm_cmpgt_epi32(r, _mm_set1_epi32(126)));
+	return _mm_sub_epi32(_mm_xor_si128(q, sign), sign);
+}
+#elif defined(MIXER_NEON)
+static inline int32x4_t div127(int32x4_t n) {
+	const int32x4_t sign = vshrq_n_s32(n, 31);
+	const uint32x4_t a = vreinterpretq_u32_s32(vabsq_s32(n));
+	uint32x4_t q = vaddq_u32(vaddq_u32(a, vshrq_n_u32(a, 7)), vaddq_u32(vshrq_n_u32(a, 14), vdupq_n_u32(1)));
+	q = vshrq_n_u32(q, 7);
+	const uint32x4_t r = vsubq_u32(a, vsubq_u32(vshlq_n_u32(q, 7), q));
+	q = vsubq_u32(q, vcgtq_u32(r, vdupq_n_u32(126)));
+	return vsubq_s32(veorq_s32(vreinterpretq_s32_u32(q), sign), sign);
+}
+#endif
+
+// adds the mono samples to the 32 bits stereo accumulator, same rounding as mix()
+static void mixMonoToStereo(int32_t *acc, const int16_t *src, int count, int volumeL, int volumeR) {
+	int i = 0;
+#if defined(MIXER_SSE2)
+	const __m128i vl = _mm_set1_epi16(volumeL);
+	const __m128i vr = _mm_set1_epi16(volumeR);
+	for (; i + 8 <= count; i += 8) {
+		const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		const __m128i lo_l = _mm_mullo_epi16(s, vl);
+		const __m128i hi_l = _mm_mulhi_epi16(s, vl);
+		const __m128i lo_r = _mm_mullo_epi16(s, vr);
+		const __m128i hi_r = _mm_mulhi_epi16(s, vr);
+		const __m128i l0 = div127(_mm_unpacklo_epi16(lo_l, hi_l));
+		const __m128i l1 = div127(_mm_unpackhi_epi16(lo_l, hi_l));
+		const __m128i r0 = div127(_mm_unpacklo_epi16(lo_r, hi_r));
+		const __m128i r1 = div127(_mm_unpackhi_epi16(lo_r, hi_r));
+		__m128i *p = (__m128i *)(acc + i * 2);
+		_mm_storeu_si128(p + 0, _mm_add_epi32(_mm_loadu_si128(p + 0), _mm_unpacklo_epi32(l0, r0)));
+		_mm_storeu_si128(p + 1, _mm_add_epi32(_mm_loadu_si128(p + 1), _mm_unpackhi_epi32(l0, r0)));
+		_mm_storeu_si128(p + 2, _mm_add_epi32(_mm_loadu_si128(p + 2), _mm_unpacklo_epi32(l1, r1)));
+		_mm_storeu_si128(p + 3, _mm_add_epi32(_mm_loadu_si128(p + 3), _mm_unpackhi_epi32(l1, r1)));
+	}
+#elif defined(MIXER_NEON)
+	for (; i + 4 <= count; i += 4) {
+		const int16x4_t s = vld1_s16(src + i);
+		int32x4x2_t lr = vld2q_s32(acc + i * 2);
+		lr.val[0] = vaddq_s32(lr.val[0], div127(vmull_n_s16(s, volumeL)));
+		lr.val[1] = vaddq_s32(lr.val[1], div127(vmull_n_s16(s, volumeR)));
+		vst2q_s32(acc + i * 2, lr);
+	}
+#endif
+	for (; i < count; ++i) {
+		acc[i * 2 + 0] += src[i] * volumeL / 127;
+		acc[i * 2 + 1] += src[i] * volumeR / 127;
+	}
+}
+
+static void packS16(int16_t *dst, const int32_t *acc, int count) {
+	int i = 0;
+#if defined(MIXER_SSE2)
+	for (; i + 8 <= count; i += 8) {
+		const __m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+		const __m128i b = _mm_loadu_si128((const __m128i *)(acc + i + 4));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+	}
+#elif defined(MIXER_NEON)
+	for (; i + 8 <= count; i += 8) {
+		const int32x4_t a = vld1q_s32(acc + i);
+		const int32x4_t b = vld1q_s32(acc + i + 4);
+		vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+	}
+#endif
+	for (; i < count; ++i) {
+		dst[i] = clipS16(acc[i]);
+	}
+}
+
 struct MixerSoundWav : MixerSound {
 	SoundDataWav data;
 	int readOffset;
@@ -289,10 +388,9 @@ struct MixerSoundWav : MixerSound {
 		return data.load(f, dataSize, mixerSampleRate);
 	}
 
-	bool readSamples(int16_t *dst, int len) {
+	bool readSamples(int16_t *dst, int count) {
 		int sample;
-		assert((len & 1) == 0);
-		for (int i = 0; i < len; i += 2) {
+		for (int i = 0; i < count; ++i) {
 			if (compressed) {
 				sample = d16Decoder.decode(data._buf[readOffset]);
 				++readOffset;
@@ -304,12 +402,11 @@ struct MixerSoundWav : MixerSound {
 				sample = (int16_t)READ_LE_UINT16(data._buf + readOffset);
 				readOffset += 2;
 			}
-			// mono to stereo
-			mix(&dst[i + 0], sample, volumeL);
-			mix(&dst[i + 1], sample, volumeR);
+			dst[i] = sample;
 			if (readOffset >= data._bufSize) {
 				--loopsCount;
 				if (loopsCount <= 0) {
+					memset(dst + i + 1, 0, (count - i - 1) * sizeof(int16_t));
 					return false;
 				}
 				readOffset = 0;
@@ -322,6 +419,36 @@ struct MixerSoundWav : MixerSound {
 	}
 };
 
+// plays the samples decoded by Mixer::decodeWav, the buffer is owned by the caller
+struct MixerSoundPcm : MixerSound {
+	const int16_t *samples;
+	int samplesCount;
+	int readOffset;
+
+	MixerSoundPcm(const int16_t *p, int count)
+		: samples(p), samplesCount(count), readOffset(0) {
+	}
+
+	bool load(File *f, int dataSize, int mixerSampleRate) {
+		return false;
+	}
+
+	bool readSamples(int16_t *dst, int count) {
+		for (int i = 0; i < count; ++i) {
+			dst[i] = samples[readOffset++];
+			if (readOffset >= samplesCount) {
+				--loopsCount;
+				if (loopsCount <= 0) {
+					memset(dst + i + 1, 0, (count - i - 1) * sizeof(int16_t));
+					return false;
+				}
+				readOffset = 0;
+			}
+		}
+		return true;
+	}
+};
+
 struct MixerSoundSpu: MixerSound {
 	SoundDataXa data;
 	int readOffset;
@@ -334,20 +461,17 @@ struct MixerSoundSpu: MixerSound {
 		return data.load(f, dataSize, mixerSampleRate);
 	}
 
-	bool readSamples(int16_t *dst, int len) {
-		for (int i = 0; i < len; i += 2) {
+	bool readSamples(int16_t *dst, int count) {
+		for (int i = 0; i < count; ++i) {
 			if (samplesOffset >= xaDecoder._samplesSize) {
-				const int count = xaDecoder.decode(data._buf + readOffset, data._bufSize - readOffset);
-				readOffset += count;
+				readOffset += xaDecoder.decode(data._buf + readOffset, data._bufSize - readOffset);
 				if (readOffset >= data._bufSize) {
+					memset(dst + i, 0, (count - i) * sizeof(int16_t));
 					return false;
 				}
 				samplesOffset = 0;
 			}
-			// mono to stereo
-			const int16_t sample = xaDecoder._samples[samplesOffset++];
-			mix(&dst[i + 0], sample, kDefaultVolume);
-			mix(&dst[i + 1], sample, kDefaultVolume);
+			dst[i] = xaDecoder._samples[samplesOffset++];
 		}
 		return true;
 	}
@@ -369,6 +493,7 @@ struct MixerQueue {
 	MixerQueueList *head;
 	uint32_t xaOffset;
 	uint32_t xaStep;
+	bool starved;
 };
 
 static void nullMixerLock(int lock) {
@@ -385,6 +510,17 @@ struct MixerLock {
 	}
 };
 
+static void freeQueue(MixerQueue *mq) {
+	MixerQueueList *mql = mq->head;
+	while (mql) {
+		MixerQueueList *next = mql->next;
+		free(mql->buffer);
+		delete mql;
+		mql = next;
+	}
+	delete mq;
+}
+
 Mixer::Mixer() {
 	_rate = 0;
 	memset(_soundsTable, 0, sizeof(_soundsTable));
@@ -395,13 +531,130 @@ Mixer::Mixer() {
 	_soundVolume = kDefaultVolume;
 	_musicVolume = kDefaultVolume;
 	_voiceVolume = kDefaultVolume;
+	memset(_commands, 0, sizeof(_commands));
+	_commandsRead = _commandsWrite = 0;
+	_queuePlaying = false;
+	_underrunsCount = 0;
+	_commandsOverflowCount = 0;
 }
 
 Mixer::~Mixer() {
+	// the audio callback is no longer running
+	processCommands();
 	for (int i = 0; i < kMaxSoundsCount; ++i) {
-		stopWav(_idsMap[i]);
+		delete _soundsTable[i];
+		_soundsTable[i] = 0;
+	}
+	if (_queue) {
+		freeQueue(_queue);
+		_queue = 0;
 	}
-	stopQueue();
+	debug(kDebug_SOUND, "Mixer::~Mixer() underruns %d commands overflow %d", _underrunsCount, _commandsOverflowCount);
+}
+
+void Mixer::postCommand(int type, uint32_t id, int value, void *ptr) {
+	const uint32_t pos = _commandsWrite;
+	if (pos - __atomic_load_n(&_commandsRead, __ATOMIC_ACQUIRE) == kMixerCommandsCount) {
+		// the audio callback is not draining the ring, process the commands with the audio locked
+		++_commandsOverflowCount;
+		MixerLock ml(_lock);
+		processCommands();
+	}
+	MixerCommand *cmd = &_commands[pos & (kMixerCommandsCount - 1)];
+	cmd->type = type;
+	cmd->id = id;
+	cmd->value = value;
+	cmd->ptr = ptr;
+	__atomic_store_n(&_commandsWrite, pos + 1, __ATOMIC_RELEASE);
+}
+
+void Mixer::processCommands() {
+	uint32_t pos = _commandsRead;
+	const uint32_t end = __atomic_load_n(&_commandsWrite, __ATOMIC_ACQUIRE);
+	for (; pos != end; ++pos) {
+		const MixerCommand *cmd = &_commands[pos & (kMixerCommandsCount - 1)];
+		switch (cmd->type) {
+		case kMixerCommand_PlaySound: {
+				MixerSound *snd = (MixerSound *)cmd->ptr;
+				for (int i = 0; i < kMaxSoundsCount; ++i) {
+					if (!_soundsTable[i]) {
+						_soundsTable[i] = snd;
+						__atomic_store_n(&_idsMap[i], cmd->id, __ATOMIC_RELEASE);
+						snd = 0;
+						break;
+					}
+				}
+				delete snd;
+			}
+			break;
+		case kMixerCommand_StopSound: {
+				const int i = findIndexById(cmd->id);
+				if (i != -1) {
+					delete _soundsTable[i];
+					_soundsTable[i] = 0;
+					__atomic_store_n(&_idsMap[i], 0, __ATOMIC_RELEASE);
+				}
+			}
+			break;
+		case kMixerCommand_LoopSound: {
+				const int i = findIndexById(cmd->id);
+				if (i != -1 && _soundsTable[i]) {
+					_soundsTable[i]->loopsCount = cmd->value;
+				}
+			}
+			break;
+		case kMixerCommand_PlayQueue:
+			if (_queue) {
+				freeQueue(_queue);
+			}
+			_queue = (MixerQueue *)cmd->ptr;
+			break;
+		case kMixerCommand_AppendQueue: {
+				MixerQueueList *mql = (MixerQueueList *)cmd->ptr;
+				MixerQueue *mq = _queue;
+				if (!mq) {
+					free(mql->buffer);
+					delete mql;
+					break;
+				}
+				if (!mq->head) {
+					mq->head = mql;
+					if (mq->starved) {
+						// the queue ran out of data before this buffer was appended
+						++_underrunsCount;
+						mq->starved = false;
+					}
+				} else {
+					MixerQueueList *current = mq->head;
+					while (current->next) {
+						current = current->next;
+					}
+					current->next = mql;
+				}
+				if (mq->size < mq->preloadSize) {
+					++mq->size;
+				}
+			}
+			break;
+		case kMixerCommand_StopQueue:
+			if (_queue) {
+				freeQueue(_queue);
+				_queue = 0;
+			}
+			break;
+		case kMixerCommand_SetMusicVolume:
+			_musicVolume = cmd->value;
+			if (_xmiPlayer) {
+				_xmiPlayer->setVolume(_musicVolume * 255 / kDefaultVolume);
+			}
+			break;
+		}
+	}
+	__atomic_store_n(&_commandsRead, pos, __ATOMIC_RELEASE);
+}
+
+int Mixer::getUnderrunsCount() const {
+	return __atomic_load_n(&_underrunsCount, __ATOMIC_RELAXED);
 }
 
 void Mixer::setSoundVolume(int volume) {
@@ -409,10 +662,7 @@ void Mixer::setSoundVolume(int volume) {
 }
 
 void Mixer::setMusicVolume(int volume) {
-	_musicVolume = volume;
-	if (_xmiPlayer) {
-		_xmiPlayer->setVolume(_musicVolume * 255 / kDefaultVolume);
-	}
+	postCommand(kMixerCommand_SetMusicVolume, 0, volume);
 }
 
 void Mixer::setVoiceVolume(int volume) {
@@ -428,19 +678,14 @@ void Mixer::setFormat(int rate, int fmt) {
 
 int Mixer::findIndexById(uint32_t id) const {
 	for (int i = 0; i < kMaxSoundsCount; ++i) {
-		if (_idsMap[i] == id) {
+		if (__atomic_load_n(&_idsMap[i], __ATOMIC_ACQUIRE) == id) {
 			return i;
 		}
 	}
 	return -1;
 }
 
-void Mixer::playWav(File *fp, int dataSize, int volume, int pan, uint32_t id, bool isVoice, bool compressed) {
-	MixerSound *snd = new MixerSoundWav(compressed);
-	if (!snd->load(fp, dataSize, _rate)) {
-		delete snd;
-		return;
-	}
+void Mixer::setVolumePan(MixerSound *snd, int volume, int pan, bool isVoice) const {
 	assert(volume >= 0 && volume < 128);
 	if (isVoice) {
 		volume = volume * _voiceVolume / kDefaultVolume;
@@ -459,105 +704,126 @@ void Mixer::playWav(File *fp, int dataSize, int volume, int pan, uint32_t id, bo
 		snd->volumeL = volume;
 		snd->volumeR = volume;
 	}
-	snd->loopsCount = 1;
-	MixerLock ml(_lock);
-	for (int i = 0; i < kMaxSoundsCount; ++i) {
-		if (!_soundsTable[i]) {
-			_soundsTable[i] = snd;
-			_idsMap[i] = id;
-			break;
+}
+
+int16_t *Mixer::decodeWav(File *fp, int dataSize, bool compressed, int *samplesCount) {
+	SoundDataWav data;
+	if (!data.load(fp, dataSize, _rate)) {
+		return 0;
+	}
+	// same decoding as MixerSoundWav::readSamples
+	const int count = compressed ? data._bufSize - 1 : data._bufSize / 2;
+	if (count <= 0) {
+		return 0;
+	}
+	int16_t *samples = (int16_t *)malloc(count * sizeof(int16_t));
+	if (samples) {
+		if (compressed) {
+			Delta16Decoder d16Decoder;
+			d16Decoder.decode(data._buf[0]);
+			for (int i = 0; i < count; ++i) {
+				samples[i] = d16Decoder.decode(data._buf[1 + i]);
+			}
+		} else {
+			for (int i = 0; i < count; ++i) {
+				samples[i] = (int16_t)READ_LE_UINT16(data._buf + i * 2);
+			}
 		}
+		*samplesCount = count;
 	}
+	return samples;
 }
 
-void Mixer::stopWav(uint32_t id) {
-	MixerLock ml(_lock);
-	const int i = findIndexById(id);
-	if (i != -1) {
-		delete _soundsTable[i];
-		_soundsTable[i] = 0;
-		_idsMap[i] = 0;
+void Mixer::playWav(File *fp, int dataSize, int volume, int pan, uint32_t id, bool isVoice, bool compressed) {
+	MixerSound *snd = new MixerSoundWav(compressed);
+	if (!snd->load(fp, dataSize, _rate)) {
+		delete snd;
+		return;
 	}
+	setVolumePan(snd, volume, pan, isVoice);
+	snd->loopsCount = 1;
+	postCommand(kMixerCommand_PlaySound, id, 0, snd);
+}
+
+void Mixer::playPcm(const int16_t *samples, int samplesCount, int volume, int pan, uint32_t id) {
+	MixerSound *snd = new MixerSoundPcm(samples, samplesCount);
+	setVolumePan(snd, volume, pan, false);
+	snd->loopsCount = 1;
+	postCommand(kMixerCommand_PlaySound, id, 0, snd);
+}
+
+void Mixer::stopWav(uint32_t id) {
+	postCommand(kMixerCommand_StopSound, id);
 }
 
 bool Mixer::isWavPlaying(uint32_t id) const {
-	MixerLock ml(_lock);
-	const int i = findIndexById(id);
-	return i != -1;
+	// the last pending command for that id gives the state the mixer will be in
+	const uint32_t end = _commandsWrite;
+	for (uint32_t pos = end; pos != __atomic_load_n(&_commandsRead, __ATOMIC_ACQUIRE); ) {
+		--pos;
+		const MixerCommand *cmd = &_commands[pos & (kMixerCommandsCount - 1)];
+		if (cmd->id == id) {
+			if (cmd->type == kMixerCommand_PlaySound) {
+				return true;
+			} else if (cmd->type == kMixerCommand_StopSound) {
+				return false;
+			}
+		}
+	}
+	return findIndexById(id) != -1;
 }
 
 void Mixer::loopWav(uint32_t id, int count) {
-	MixerLock ml(_lock);
-	const int i = findIndexById(id);
-	if (i != -1 && _soundsTable[i]) {
-		_soundsTable[i]->loopsCount = count;
-	}
+	postCommand(kMixerCommand_LoopSound, id, count);
 }
 
 void Mixer::playQueue(int preloadSize, int type) {
-	stopQueue();
-	MixerLock ml(_lock);
-	_queue = new MixerQueue;
-	_queue->preloadSize = preloadSize;
-	_queue->type = type;
-	_queue->size = 0;
-	_queue->head = 0;
+	MixerQueue *mq = new MixerQueue;
+	mq->preloadSize = preloadSize;
+	mq->type = type;
+	mq->size = 0;
+	mq->head = 0;
+	mq->starved = false;
 	if (type == kMixerQueueType_XA) {
-		_queue->xaOffset = 0;
-		_queue->xaStep = 2 * (37800 << kFracBits) / _rate; // stereo
-		_queue->xaDecoder.reset(true); // stereo
+		mq->xaOffset = 0;
+		mq->xaStep = 2 * (37800 << kFracBits) / _rate; // stereo
+		mq->xaDecoder.reset(true); // stereo
 	}
+	postCommand(kMixerCommand_PlayQueue, 0, 0, mq);
+	_queuePlaying = true;
 }
 
 void Mixer::appendToQueue(const uint8_t *buf, int size) {
-	MixerLock ml(_lock);
-	MixerQueue *mq = _queue;
-	if (mq) {
+	if (_queuePlaying) {
 		MixerQueueList *mql = new MixerQueueList;
 		mql->buffer = (uint8_t *)malloc(size);
 		memcpy(mql->buffer, buf, size);
 		mql->read = 0;
 		mql->size = size;
 		mql->next = 0;
-		if (!mq->head) {
-			mq->head = mql;
-		} else {
-			MixerQueueList *current = mq->head;
-			while (current->next) {
-				current = current->next;
-			}
-			current->next = mql;
-		}
-		if (mq->size < mq->preloadSize) {
-			++mq->size;
-		}
+		postCommand(kMixerCommand_AppendQueue, 0, 0, mql);
 	}
 }
 
 void Mixer::stopQueue() {
-	MixerLock ml(_lock);
-	if (_queue) {
-		MixerQueueList *mql = _queue->head;
-		while (mql) {
-			MixerQueueList *next = mql->next;
-			free(mql->buffer);
-			delete mql;
-			mql = next;
-		}
-		delete _queue;
-		_queue = 0;
+	if (_queuePlaying) {
+		postCommand(kMixerCommand_StopQueue, 0);
+		_queuePlaying = false;
 	}
 }
 
+// the music changes are rare enough to keep using the audio lock
 void Mixer::playXmi(File *f, int size) {
-	MixerLock ml(_lock);
-	_xmiPlayer->unload();
 	uint8_t *buf = (uint8_t *)malloc(size);
 	if (buf) {
 		fileRead(f, buf, size);
+	}
+	MixerLock ml(_lock);
+	_xmiPlayer->unload();
+	if (buf) {
 		_xmiPlayer->load(buf, size);
-		free(buf);
 	}
+	free(buf);
 }
 
 void Mixer::stopXmi() {
@@ -571,17 +837,11 @@ void Mixer::playXa(File *fp, int dataSize, uint32_t id) {
 		delete snd;
 		return;
 	}
-	snd->volumeL = _soundVolume;
-	snd->volumeR = _soundVolume;
+	// the SPU samples are mixed at full volume
+	snd->volumeL = kDefaultVolume;
+	snd->volumeR = kDefaultVolume;
 	snd->loopsCount = 0;
-	MixerLock ml(_lock);
-	for (int i = 0; i < kMaxSoundsCount; ++i) {
-		if (!_soundsTable[i]) {
-			_soundsTable[i] = snd;
-			_idsMap[i] = id;
-			break;
-		}
-	}
+	postCommand(kMixerCommand_PlaySound, id, 0, snd);
 }
 
 void Mixer::stopXa(uint32_t id) {
@@ -591,9 +851,10 @@ void Mixer::stopXa(uint32_t id) {
 void Mixer::mixBuf(int16_t *buf, int len) {
 	assert((len & 1) == 0);
 	memset(buf, 0, len * sizeof(int16_t));
+	processCommands();
 	if (!_queue && _xmiPlayer) {
 		_xmiPlayer->readSamples(buf, len);
-	} else if (_queue->size >= _queue->preloadSize) {
+	} else if (_queue && _queue->size >= _queue->preloadSize) {
 		MixerQueueList *mql = _queue->head;
 		switch (_queue->type) {
 		case kMixerQueueType_D16:
@@ -643,18 +904,117 @@ void Mixer::mixBuf(int16_t *buf, int len) {
 			}
 			break;
 		}
+		if (!_queue->head) {
+			_queue->starved = true;
+		}
 	}
-	for (int i = 0; i < kMaxSoundsCount; ++i) {
-		if (_soundsTable[i]) {
-			if (!_soundsTable[i]->readSamples(buf, len)) {
-				delete _soundsTable[i];
+	mixSounds(buf, len);
+}
+
+void Mixer::mixSounds(int16_t *buf, int len, bool reference) {
+	// the sounds are mixed by blocks in a 32 bits accumulator, saturated once
+	int16_t samples[kMixBlockSize];
+	int32_t acc[kMixBlockSize * 2];
+	for (int offset = 0; offset < len; offset += kMixBlockSize * 2) {
+		int16_t *dst = buf + offset;
+		const int count = MIN(len - offset, kMixBlockSize * 2) / 2;
+		bool mixed = false;
+		for (int i = 0; i < kMaxSoundsCount; ++i) {
+			MixerSound *snd = _soundsTable[i];
+			if (!snd) {
+				continue;
+			}
+			const bool playing = snd->readSamples(samples, count);
+			if (reference) {
+				mixMonoToStereoRef(dst, samples, count, snd->volumeL, snd->volumeR);
+			} else {
+				if (!mixed) {
+					for (int j = 0; j < count * 2; ++j) {
+						acc[j] = dst[j];
+					}
+					mixed = true;
+				}
+				mixMonoToStereo(acc, samples, count, snd->volumeL, snd->volumeR);
+			}
+			if (!playing) {
+				delete snd;
 				_soundsTable[i] = 0;
-				_idsMap[i] = 0;
+				__atomic_store_n(&_idsMap[i], 0, __ATOMIC_RELEASE);
 			}
 		}
+		if (mixed) {
+			packS16(dst, acc, count * 2);
+		}
 	}
 }
 
 void Mixer::mixCb(void *param, uint8_t *buf, int len) {
+	TraceZone zone("Mixer::mixCb");
 	((Mixer *)param)->mixBuf((int16_t *)buf, len / 2);
 }
+
+void benchmarkMixer() {
+	static const int kSamplesCount = 22050;
+	static const int kBufferSize = 4096; // stereo samples
+	static const int kIterations = 2000;
+	int16_t *pcm = (int16_t *)malloc(kMaxSoundsCount * kSamplesCount * sizeof(int16_t));
+	int16_t *buf[2];
+	for (int i = 0; i < 2; ++i) {
+		buf[i] = (int16_t *)malloc(kBufferSize * sizeof(int16_t));
+	}
+	if (!pcm || !buf[0] || !buf[1]) {
+		free(pcm);
+		free(buf[0]);
+		free(buf[1]);
+		return;
+	}
+	// all the slots playing, looping noise at various levels
+	uint32_t rnd = 0x1234;
+	Mixer mixers[2];
+	for (int i = 0; i < kMaxSoundsCount; ++i) {
+		int16_t *samples = pcm + i * kSamplesCount;
+		const int amplitude = 256 << (i & 7);
+		for (int j = 0; j < kSamplesCount; ++j) {
+			rnd = rnd * 1103515245 + 12345;
+			samples[j] = (int)((rnd >> 16) % (2 * amplitude)) - amplitude;
+		}
+		rnd = rnd * 1103515245 + 12345;
+		const int volume = (rnd >> 16) & 127;
+		const int pan = (rnd >> 24) & 127;
+		for (int m = 0; m < 2; ++m) {
+			MixerSound *snd = new MixerSoundPcm(samples, kSamplesCount);
+			mixers[m].setVolumePan(snd, volume, pan, false);
+			snd->loopsCount = kIterations;
+			mixers[m]._soundsTable[i] = snd;
+		}
+	}
+	uint64_t t[2] = { 0, 0 };
+	int diffCount = 0;
+	int diffMax = 0;
+	for (int n = 0; n < kIterations; ++n) {
+		for (int m = 0; m < 2; ++m) {
+			memset(buf[m], 0, kBufferSize * sizeof(int16_t));
+			const uint64_t t0 = getTimeMicros();
+			mixers[m].mixSounds(buf[m], kBufferSize, m == 0);
+			t[m] += getTimeMicros() - t0;
+		}
+		for (int i = 0; i < kBufferSize; ++i) {
+			const int diff = ABS(buf[0][i] - buf[1][i]);
+			if (diff != 0) {
+				++diffCount;
+				if (diff > diffMax) {
+					diffMax = diff;
+				}
+			}
+		}
+	}
+	const double samples = kBufferSize / 2 * (double)kIterations * kMaxSoundsCount;
+	for (int m = 0; m < 2; ++m) {
+		printf("%s: %.1f MSamples/s\n", m == 0 ? "reference" : "mixer", t[m] != 0 ? samples / t[m] : 0.);
+	}
+	// the reference clips after each sound, the accumulator only once
+	printf("differences %d (%.2f%%) max %d\n", diffCount, diffCount * 100. / (kBufferSize * (double)kIterations), diffMax);
+	free(pcm);
+	free(buf[0]);
+	free(buf[1]);
+}
@@ -12,6 +12,8 @@ enum {
 	kMaxSoundsCount = 32,
 	kMaxQueuesCount = 1,
 	kFracBits = 10,
+	kMixerCommandsCount = 256, // power of 2
+	kMixBlockSize = 256 // mono samples
 };
 
 enum {
@@ -24,13 +26,30 @@ enum {
 	kMixerQueueType_XA, // stereo 37800Hz
 };
 
+enum {
+	kMixerCommand_PlaySound,
+	kMixerCommand_StopSound,
+	kMixerCommand_LoopSound,
+	kMixerCommand_PlayQueue,
+	kMixerCommand_AppendQueue,
+	kMixerCommand_StopQueue,
+	kMixerCommand_SetMusicVolume,
+};
+
+struct MixerCommand {
+	int type;
+	uint32_t id;
+	int value;
+	void *ptr; // MixerSound, MixerQueue or MixerQueueList
+};
+
 struct MixerSound {
 	int volumeL;
 	int volumeR;
 	int loopsCount;
 	virtual ~MixerSound() {}
 	virtual bool load(File *f, int dataSize, int mixerSampleRate) = 0;
-	virtual bool readSamples(int16_t *, int len) = 0;
+	virtual bool readSamples(int16_t *, int count) = 0; // mono, zero padded when finished
 };
 
 struct MixerQueue;
@@ -46,10 +65,20 @@ struct Mixer {
 	int _soundVolume;
 	int _musicVolume;
 	int _voiceVolume;
+	// single producer (game thread), single consumer (mixBuf) ring
+	MixerCommand _commands[kMixerCommandsCount];
+	uint32_t _commandsRead, _commandsWrite;
+	bool _queuePlaying;
+	int _underrunsCount;
+	int _commandsOverflowCount;
 
 	Mixer();
 	~Mixer();
 
+	void postCommand(int type, uint32_t id, int value = 0, void *ptr = 0);
+	void processCommands();
+	int getUnderrunsCount() const;
+
 	void setSoundVolume(int volume);
 	void setMusicVolume(int volume);
 	void setVoiceVolume(int volume);
@@ -57,7 +86,10 @@ struct Mixer {
 	void setFormat(int rate, int fmt);
 	int findIndexById(uint32_t id) const;
 
+	void setVolumePan(MixerSound *snd, int volume, int pan, bool isVoice) const;
+	int16_t *decodeWav(File *, int dataSize, bool compressed, int *samplesCount);
 	void playWav(File *, int dataSize, int volume, int pan, uint32_t id, bool isVoice, bool compressed = true);
+	void playPcm(const int16_t *samples, int samplesCount, int volume, int pan, uint32_t id);
 	void stopWav(uint32_t);
 	bool isWavPlaying(uint32_t) const;
 	void loopWav(uint32_t, int count);
@@ -73,7 +105,10 @@ struct Mixer {
 	void stopXa(uint32_t);
 
 	void mixBuf(int16_t *buf, int len);
+	void mixSounds(int16_t *buf, int len, bool reference = false);
 	static void mixCb(void *param, uint8_t *buf, int len);
 };
 
+void benchmarkMixer();
+
 #endif // MIXER_H__
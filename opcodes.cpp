@@ -490,6 +490,8 @@ int Game::op_jumpToNextLevel(int argc, int32_t *argv) {
 	debug(kDebug_OPCODES, "Game::op_jumpToNextLevel() []");
 	++_level;
 	_changeLevel = true;
+	// the next level data is read while the end of level cutscene plays
+	_res.prefetchLevelData(_level);
 	int32_t target = -1;
 	op_clearTarget(1, &target);
 	return -1;
@@ -739,7 +739,7 @@ int Game::rayCast(GameObject *o, int xStartRay, RayCastCallbackType callback, in
 			}
 			CellMap *cellMap = getCellMap(rayxex, rayxez);
 			if (type == kRayCastWall) {
-				cellMap->draw |= kCellMapDrawGround;
+				setCellMapDraw(cellMap, kCellMapDrawGround);
 				if (cellMap->type == 20) {
 					_decorTexture = cellMap->texture[0];
 				}
@@ -749,7 +749,7 @@ int Game::rayCast(GameObject *o, int xStartRay, RayCastCallbackType callback, in
 					const int num = (_dzRay > 0) ? cellMap->south : cellMap->north;
 					if (num) {
 						if (type == kRayCastWall) {
-							cellMap->draw |= kCellMapDrawWall;
+							setCellMapDraw(cellMap, kCellMapDrawWall);
 						}
 						xray = 1;
 						break;
@@ -768,14 +768,14 @@ int Game::rayCast(GameObject *o, int xStartRay, RayCastCallbackType callback, in
 					}
 					if ((type == kRayCastCamera) || testRayX(xStartRay, cellMap, _resXRayX, _resZRayX, rayxex, rayxez, type)) {
 						if (type == kRayCastWall) {
-							cellMap->draw |= kCellMapDrawWall;
+							setCellMapDraw(cellMap, kCellMapDrawWall);
 						}
 						xray = 2;
 						break;
 					}
 					if (_xTransparent) {
 						if (type == kRayCastWall) {
-							cellMap->draw |= kCellMapDrawWall;
+							setCellMapDraw(cellMap, kCellMapDrawWall);
 						}
 					}
 				}
@@ -813,7 +813,7 @@ int Game::rayCast(GameObject *o, int xStartRay, RayCastCallbackType callback, in
 			}
 			CellMap *cellMap = getCellMap(rayzex, rayzez);
 			if (type == kRayCastWall) {
-				cellMap->draw |= kCellMapDrawGround;
+				setCellMapDraw(cellMap, kCellMapDrawGround);
 				if (cellMap->type == 20) {
 					_decorTexture = cellMap->texture[0];
 				}
@@ -823,7 +823,7 @@ int Game::rayCast(GameObject *o, int xStartRay, RayCastCallbackType callback, in
 					const int num = (_dxRay > 0) ? cellMap->west : cellMap->east;
 					if (num) {
 						if (type == kRayCastWall) {
-							cellMap->draw |= kCellMapDrawWall;
+							setCellMapDraw(cellMap, kCellMapDrawWall);
 						}
 						zray = 1;
 						break;
@@ -842,14 +842,14 @@ int Game::rayCast(GameObject *o, int xStartRay, RayCastCallbackType callback, in
 					}
 					if ((type == kRayCastCamera) || testRayZ(xStartRay, cellMap, _resXRayZ, _resZRayZ, rayzex, rayzez, type)) {
 						if (type == kRayCastWall) {
-							cellMap->draw |= kCellMapDrawWall;
+							setCellMapDraw(cellMap, kCellMapDrawWall);
 						}
 						zray = 2;
 						break;
 					}
 					if (_zTransparent) {
 						if (type == kRayCastWall) {
-							cellMap->draw |= kCellMapDrawWall;
+							setCellMapDraw(cellMap, kCellMapDrawWall);
 						}
 					}
 				}
@@ -937,7 +937,58 @@ int Game::rayCastCamera(GameObject *o, int sx, CellMap *cm, RayCastCallbackType
 	return objKey;
 }
 
+static int compareCellIndex(const void *a, const void *b) {
+	return *(const uint16_t *)a - *(const uint16_t *)b;
+}
+
+uint32_t Game::getSceneVisibilityHash() const {
+	const CellMap *cellMap = &_sceneCellMap[0][0];
+	uint32_t hash = 2166136261U;
+	for (int i = 0; i < _sceneVisibility.cellsCount; ++i) {
+		const CellMap *cell = &cellMap[_sceneVisibility.cells[i]];
+		hash = (hash ^ (uint16_t)cell->type) * 16777619U;
+		hash = (hash ^ (uint8_t)cell->data[0]) * 16777619U;
+		hash = (hash ^ (uint8_t)cell->data[1]) * 16777619U;
+		// op_setCellMapData can change the decor textures
+		hash = (hash ^ (uint16_t)cell->texture[0]) * 16777619U;
+		hash = (hash ^ (uint16_t)cell->texture[1]) * 16777619U;
+	}
+	return hash;
+}
+
+bool Game::replaySceneVisibility(int x, int z) {
+	SceneVisibility *vis = &_sceneVisibility;
+	if (!vis->valid || vis->x != x || vis->z != z || vis->cosObserver != _yCosObserver || vis->sinObserver != _ySinObserver) {
+		return false;
+	}
+	// the rays only depend on the cells they cross, none of the doors changed if the hash matches
+	if (getSceneVisibilityHash() != vis->cellsHash) {
+		return false;
+	}
+	++_rayCastCounter;
+	CellMap *cellMap = &_sceneCellMap[0][0];
+	for (int i = 0; i < vis->cellsCount; ++i) {
+		CellMap *cell = &cellMap[vis->cells[i]];
+		cell->draw = vis->cellsDraw[i];
+		if (cell->colSlot && cell->rayCastCounter != _rayCastCounter) {
+			// same objects as the first visit of the cell in rayCast()
+			if ((i != 0 && cell->type > 1) || cell->type == 0 || cell->type == -3) {
+				addObjectToDrawList(cell);
+			}
+			cell->rayCastCounter = _rayCastCounter;
+		}
+	}
+	_decorTexture = vis->decorTexture;
+	return true;
+}
+
 void Game::rayCastWall(int x, int z) {
+	if (_params.sceneVisibilityCache && replaySceneVisibility(x, z)) {
+		return;
+	}
+	_sceneVisibility.valid = false;
+	_sceneVisibility.cellsCount = 0;
+
 	++_rayCastCounter;
 
 	_xPosRay = x << 2;
@@ -954,7 +1005,7 @@ void Game::rayCastWall(int x, int z) {
 	}
 	if (rayxex < kMapSizeX && rayxez < kMapSizeZ) {
 		CellMap *cellMap = getCellMap(rayxex, rayxez);
-		cellMap->draw |= kCellMapDrawGround;
+		setCellMapDraw(cellMap, kCellMapDrawGround);
 		if (cellMap->colSlot && cellMap->rayCastCounter != _rayCastCounter) {
 			switch (cellMap->type) {
 			case 0:
@@ -969,4 +1020,19 @@ void Game::rayCastWall(int x, int z) {
 	for (int x = -margin; x < kScreenWidth + margin; ++x) {
 		rayCast(0, x, 0, kRayCastWall);
 	}
+
+	SceneVisibility *vis = &_sceneVisibility;
+	const CellMap *cellMap = &_sceneCellMap[0][0];
+	for (int i = 0; i < vis->cellsCount; ++i) {
+		vis->cellsDraw[i] = cellMap[vis->cells[i]].draw;
+	}
+	memcpy(vis->drawCells, vis->cells, vis->cellsCount * sizeof(uint16_t));
+	qsort(vis->drawCells, vis->cellsCount, sizeof(uint16_t), compareCellIndex);
+	vis->x = x;
+	vis->z = z;
+	vis->cosObserver = _yCosObserver;
+	vis->sinObserver = _ySinObserver;
+	vis->cellsHash = getSceneVisibilityHash();
+	vis->decorTexture = _decorTexture;
+	vis->valid = true;
 }
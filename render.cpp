@@ -150,6 +150,305 @@ static Vertex3f _cameraPos;
 static GLfloat _cameraPitch;
 struct timeval _frameTimeStamp;
 
+static void setColor(GLubyte *rgba, int r, int g, int b, int a) {
+	rgba[0] = r;
+	rgba[1] = g;
+	rgba[2] = b;
+	rgba[3] = a;
+}
+
+static void setTexCoords(GLfloat *uv, GLfloat u0, GLfloat v0, GLfloat u1, GLfloat v1, GLfloat u2, GLfloat v2) {
+	uv[0] = u0; uv[1] = v0;
+	uv[2] = u1; uv[3] = v1;
+	uv[4] = u2; uv[5] = v2;
+}
+
+static void setTexCoords(GLfloat *uv, GLfloat u0, GLfloat v0, GLfloat u1, GLfloat v1, GLfloat u2, GLfloat v2, GLfloat u3, GLfloat v3) {
+	setTexCoords(uv, u0, v0, u1, v1, u2, v2);
+	uv[6] = u3; uv[7] = v3;
+}
+
+//
+// frame recording : with interpolation enabled, the draw calls of a game tick
+// are queued and replayed on each display frame. The camera and the objects
+// transformations are interpolated with the ones of the previous tick.
+//
+
+enum {
+	kRenderCmd_ClearScreen,
+	kRenderCmd_SetupProjection,
+	kRenderCmd_SetIgnoreDepth,
+	kRenderCmd_BeginObjectDraw,
+	kRenderCmd_EndObjectDraw,
+	kRenderCmd_PolygonFlat,
+	kRenderCmd_PolygonTexture,
+	kRenderCmd_Particles,
+	kRenderCmd_Sprite,
+	kRenderCmd_Rectangle
+};
+
+static const int kInterpolateDistanceMax = 32; // teleports and camera cuts are not interpolated
+
+struct RenderCommand {
+	int type;
+	int args[8];
+	GLfloat camera[4]; // x, y, z, pitch
+	int first, count; // recorded vertices
+	int prev; // same camera or object in the previous tick, -1 if none
+};
+
+struct RenderFrame {
+	RenderCommand *commands;
+	int commandsCount, commandsSize;
+	Vertex *vertices;
+	int verticesCount, verticesSize;
+	int *objects; // kRenderCmd_BeginObjectDraw commands
+	int objectsCount, objectsSize;
+};
+
+static struct {
+	bool recording; // commands are kept until the next beginFrame
+	bool replaying;
+	bool matched;
+	RenderFrame frames[2]; // current and previous game tick
+} _recorder;
+
+static void *growArray(void *p, int *size, int count, int elementSize) {
+	if (count > *size) {
+		const int newSize = MAX(count, *size * 2 + 256);
+		p = realloc(p, newSize * elementSize);
+		if (!p) {
+			error("Unable to allocate %d render commands", newSize);
+		}
+		*size = newSize;
+	}
+	return p;
+}
+
+static RenderCommand *recordCommand(int type, const Vertex *vertices = 0, int count = 0) {
+	RenderFrame *f = &_recorder.frames[0];
+	f->commands = (RenderCommand *)growArray(f->commands, &f->commandsSize, f->commandsCount + 1, sizeof(RenderCommand));
+	f->vertices = (Vertex *)growArray(f->vertices, &f->verticesSize, f->verticesCount + count, sizeof(Vertex));
+	RenderCommand *cmd = &f->commands[f->commandsCount];
+	memset(cmd, 0, sizeof(RenderCommand));
+	cmd->type = type;
+	cmd->first = f->verticesCount;
+	cmd->count = count;
+	cmd->prev = -1;
+	if (count != 0) {
+		memcpy(f->vertices + f->verticesCount, vertices, count * sizeof(Vertex));
+		f->verticesCount += count;
+	}
+	if (type == kRenderCmd_BeginObjectDraw) {
+		f->objects = (int *)growArray(f->objects, &f->objectsSize, f->objectsCount + 1, sizeof(int));
+		f->objects[f->objectsCount++] = f->commandsCount;
+	}
+	++f->commandsCount;
+	return cmd;
+}
+
+static void matchRecordedCommands() {
+	RenderFrame *cur = &_recorder.frames[0];
+	const RenderFrame *prev = &_recorder.frames[1];
+	// game projections, in order
+	int j = 0;
+	for (int i = 0; i < cur->commandsCount; ++i) {
+		RenderCommand *cmd = &cur->commands[i];
+		if (cmd->type == kRenderCmd_SetupProjection && cmd->args[0] == kProjGame) {
+			while (j < prev->commandsCount && !(prev->commands[j].type == kRenderCmd_SetupProjection && prev->commands[j].args[0] == kProjGame)) {
+				++j;
+			}
+			if (j < prev->commandsCount) {
+				cmd->prev = j++;
+			}
+		}
+	}
+	// objects, the same key can be drawn more than once (shadow)
+	for (int i = 0; i < cur->objectsCount; ++i) {
+		RenderCommand *cmd = &cur->commands[cur->objects[i]];
+		const int key = cmd->args[5];
+		if (key == -1) {
+			continue;
+		}
+		int occurrence = 0;
+		for (int k = 0; k < i; ++k) {
+			if (cur->commands[cur->objects[k]].args[5] == key) {
+				++occurrence;
+			}
+		}
+		for (int k = 0; k < prev->objectsCount; ++k) {
+			if (prev->commands[prev->objects[k]].args[5] == key && occurrence-- == 0) {
+				cmd->prev = prev->objects[k];
+				break;
+			}
+		}
+	}
+}
+
+static int interpolate(int a, int b, int alpha) {
+	return a + (int)(((int64_t)b - a) * alpha >> 8);
+}
+
+//
+// batched rendering : polygons are queued with their vertices transformed to
+// world coordinates and submitted with vertex arrays, grouped by texture.
+// the batch key is the texture id shifted left by one, the lowest bit set
+// for lit flat polygons. translucent polygons are drawn last, in order.
+//
+
+static const int kBatchVerticesSize = 8192;
+static const int kBatchPolygonsSize = 2048;
+static const uint32_t kBatchKeyTranslucent = 0xFFFFFFFF;
+
+struct BatchVertex {
+	GLfloat x, y, z;
+	GLfloat u, v;
+	GLfloat nx, ny, nz;
+	GLubyte rgba[4];
+};
+
+struct BatchPolygon {
+	uint32_t key;
+	const Texture *tex;
+	int first, count;
+};
+
+static struct {
+	BatchVertex vertices[kBatchVerticesSize];
+	int verticesCount;
+	BatchPolygon polygons[kBatchPolygonsSize];
+	int polygonsCount;
+	GLushort indices[kBatchVerticesSize * 3];
+	bool objectDraw;
+	GLfloat tx, ty, tz;
+	GLfloat cosRy, sinRy;
+} _batch;
+
+static int compareBatchPolygon(const void *a, const void *b) {
+	const BatchPolygon *p1 = (const BatchPolygon *)a;
+	const BatchPolygon *p2 = (const BatchPolygon *)b;
+	if (p1->key != p2->key) {
+		return (p1->key < p2->key) ? -1 : 1;
+	}
+	return p1->first - p2->first;
+}
+
+static void flushBatch();
+
+static void batchPolygon(uint32_t key, const Texture *tex, const Vertex *vertices, int count, const GLfloat *uv, const GLubyte *rgba) {
+	if (_batch.verticesCount + count > kBatchVerticesSize || _batch.polygonsCount >= kBatchPolygonsSize) {
+		flushBatch();
+	}
+	BatchPolygon *p = &_batch.polygons[_batch.polygonsCount++];
+	p->key = key;
+	p->tex = tex;
+	p->first = _batch.verticesCount;
+	p->count = count;
+	BatchVertex *v = &_batch.vertices[_batch.verticesCount];
+	for (int i = 0; i < count; ++i, ++v) {
+		if (_batch.objectDraw) {
+			// same transformation as beginObjectDraw
+			const GLfloat x = vertices[i].x / 8.;
+			const GLfloat z = vertices[i].z / 8.;
+			v->x = _batch.cosRy * x + _batch.sinRy * z + _batch.tx;
+			v->y = vertices[i].y / 2. + _batch.ty;
+			v->z = _batch.cosRy * z - _batch.sinRy * x + _batch.tz;
+			const GLfloat nx = vertices[i].nx * 4.;
+			const GLfloat nz = vertices[i].nz * 4.;
+			v->nx = _batch.cosRy * nx + _batch.sinRy * nz;
+			v->ny = vertices[i].ny;
+			v->nz = _batch.cosRy * nz - _batch.sinRy * nx;
+		} else {
+			v->x = vertices[i].x;
+			v->y = vertices[i].y;
+			v->z = vertices[i].z;
+			v->nx = vertices[i].nx;
+			v->ny = vertices[i].ny;
+			v->nz = vertices[i].nz;
+		}
+		if (uv) {
+			v->u = uv[i * 2];
+			v->v = uv[i * 2 + 1];
+		} else {
+			v->u = v->v = 0.;
+		}
+		memcpy(v->rgba, rgba, 4);
+	}
+	_batch.verticesCount += count;
+}
+
+static void drawBatchElements(const BatchPolygon *p, const GLushort *indices, int count) {
+	const bool lit = (p->key != kBatchKeyTranslucent) && (p->key & 1) != 0;
+	if (p->tex) {
+		glEnable(GL_TEXTURE_2D);
+		_textureCache.bindTexture(p->tex);
+	}
+	if (lit) {
+		glEnable(GL_LIGHTING);
+		glEnable(GL_COLOR_MATERIAL);
+		glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+	}
+	glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, indices);
+	if (lit) {
+		glDisable(GL_COLOR_MATERIAL);
+		glDisable(GL_LIGHTING);
+	}
+	if (p->tex) {
+		_textureCache.unbindTexture(p->tex);
+		glDisable(GL_TEXTURE_2D);
+	}
+}
+
+static void flushBatch() {
+	if (_batch.polygonsCount != 0) {
+		qsort(_batch.polygons, _batch.polygonsCount, sizeof(BatchPolygon), compareBatchPolygon);
+		const BatchVertex *v = _batch.vertices;
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(3, GL_FLOAT, sizeof(BatchVertex), &v->x);
+		glTexCoordPointer(2, GL_FLOAT, sizeof(BatchVertex), &v->u);
+		glNormalPointer(GL_FLOAT, sizeof(BatchVertex), &v->nx);
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BatchVertex), v->rgba);
+		int first = 0;
+		int count = 0;
+		for (int i = 0; i < _batch.polygonsCount; ++i) {
+			const BatchPolygon *p = &_batch.polygons[i];
+			if (i != 0 && p->key != _batch.polygons[i - 1].key) {
+				drawBatchElements(&_batch.polygons[i - 1], _batch.indices + first, count - first);
+				first = count;
+			}
+			// triangle fan
+			for (int j = 2; j < p->count; ++j) {
+				_batch.indices[count++] = p->first;
+				_batch.indices[count++] = p->first + j - 1;
+				_batch.indices[count++] = p->first + j;
+			}
+		}
+		drawBatchElements(&_batch.polygons[_batch.polygonsCount - 1], _batch.indices + first, count - first);
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_NORMAL_ARRAY);
+#ifndef USE_GLES
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+#endif
+		_batch.polygonsCount = 0;
+		_batch.verticesCount = 0;
+	}
+	// textures referenced by the queued polygons can now be released, unless recorded commands still point to them
+	if (!_recorder.recording) {
+		_textureCache.evictTextures(0);
+	}
+}
+
+// particles, submitted with a single GL_POINTS draw
+static struct {
+	GLfloat *vertices;
+	GLubyte *rgba;
+	int size;
+} _points;
+
 Render::Render(const RenderParams *params) {
 	memset(_clut, 0, sizeof(_clut));
 	_aspectRatio = 1.;
@@ -160,11 +459,17 @@ Render::Render(const RenderParams *params) {
 	_viewport.changed = true;
 	_viewport.wScale = 256;
 	_viewport.hScale = 256;
-	_textureCache.init(params->textureFilter, params->textureScaler);
+	_textureCache.init(params->textureFilter, params->textureScaler, params->textureCacheSize << 20, params->gpuPalette);
 	_paletteGreyScale = false;
 	_paletteRgbScale = 256;
 	_fog = params->fog;
 	_lighting = params->gouraud;
+	_batching = params->batching;
+	_interpolation = params->interpolation;
+	_textureCache._deferEviction = _batching || _interpolation;
+	memset(&_batch, 0, sizeof(_batch));
+	memset(&_recorder, 0, sizeof(_recorder));
+	_recorder.recording = _interpolation;
 	_drawObjectIgnoreDepth = false;
 	gettimeofday(&_frameTimeStamp, 0);
 	_framesCount = 0;
@@ -195,9 +500,19 @@ Render::Render(const RenderParams *params) {
 
 Render::~Render() {
 	free(_screenshotBuf);
+	for (int i = 0; i < 2; ++i) {
+		free(_recorder.frames[i].commands);
+		free(_recorder.frames[i].vertices);
+		free(_recorder.frames[i].objects);
+	}
+	free(_points.vertices);
+	free(_points.rgba);
 }
 
 void Render::flushCachedTextures() {
+	flushBatch();
+	const TextureCacheStats *stats = &_textureCache._stats;
+	debug(kDebug_RENDER, "Texture cache: %d textures (%d KB), hits %d misses %d evictions %d", stats->texturesCount, stats->memSize >> 10, stats->hits, stats->misses, stats->evictions);
 	_textureCache.flush();
 	_overlay.tex = 0;
 }
@@ -233,56 +548,91 @@ bool Render::hasTexture(int16_t key) {
 
 void Render::prepareTextureLut(const uint8_t *data, int w, int h, const uint8_t *clut, int16_t texKey) {
 	_textureCache.getCachedTexture(texKey, data, w, h, false, clut);
+	_textureCache.pinTexture(texKey);
 }
 
 void Render::prepareTextureRgb(const uint8_t *data, int w, int h, int16_t texKey) {
 	_textureCache.getCachedTexture(texKey, data, w, h, true);
+	_textureCache.pinTexture(texKey);
 }
 
 void Render::releaseTexture(int16_t texKey) {
+	flushBatch();
 	_textureCache.releaseTexture(texKey);
 }
 
+void Render::beginTextureAtlas() {
+	flushBatch();
+	_textureCache.beginAtlas();
+}
+
+void Render::addToTextureAtlas(const uint8_t *data, int w, int h, int16_t texKey) {
+	_textureCache.addToAtlas(texKey, data, w, h);
+}
+
+void Render::endTextureAtlas() {
+	_textureCache.endAtlas();
+}
+
+void Render::getTextureCacheStats(TextureCacheStats *stats) const {
+	*stats = _textureCache._stats;
+}
+
 void Render::drawPolygonFlat(const Vertex *vertices, int verticesCount, int color) {
+	if (_interpolation && !_recorder.replaying) {
+		recordCommand(kRenderCmd_PolygonFlat, vertices, verticesCount)->args[0] = color;
+		return;
+	}
 	bool lightFlatColor = false;
+	GLubyte rgba[4];
 	switch (color) {
 	case kFlatColorRed:
-		glColor4ub(255, 0, 0, 127);
+		setColor(rgba, 255, 0, 0, 127);
 		break;
 	case kFlatColorGreen:
-		glColor4ub(0, 255, 0, 127);
+		setColor(rgba, 0, 255, 0, 127);
 		break;
 	case kFlatColorYellow:
-		glColor4ub(255, 255, 0, 127);
+		setColor(rgba, 255, 255, 0, 127);
 		break;
 	case kFlatColorBlue:
-		glColor4ub(0, 0, 255, 127);
+		setColor(rgba, 0, 0, 255, 127);
 		break;
 	case kFlatColorShadow:
-		glColor4ub(0, 0, 0, 63);
+		setColor(rgba, 0, 0, 0, 63);
 		break;
 	case kFlatColorLight:
-		glColor4ub(255, 255, 255, 63);
+		setColor(rgba, 255, 255, 255, 63);
 		break;
 	case kFlatColorLight9:
-		glColor4ub(255, 255, 255, 127);
+		setColor(rgba, 255, 255, 255, 127);
 		break;
 	default:
 		if (color >= 0 && color < 256) {
-			if (_lighting) {
-				glEnable(GL_LIGHTING);
-				glEnable(GL_COLOR_MATERIAL);
-				glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
-				lightFlatColor = true;
-			}
-			glColor4ub(_clut[color * 3], _clut[color * 3 + 1], _clut[color * 3 + 2], color == 0 ? 0 : 255);
+			lightFlatColor = _lighting;
+			setColor(rgba, _clut[color * 3], _clut[color * 3 + 1], _clut[color * 3 + 2], color == 0 ? 0 : 255);
 		} else {
 			warning("Render::drawPolygonFlat() unhandled color %d", color);
+			setColor(rgba, 255, 255, 255, 255);
 		}
 		break;
 	}
+	if (_batching) {
+		uint32_t key = lightFlatColor ? 1 : 0;
+		if (rgba[3] != 0 && rgba[3] != 255) {
+			key = kBatchKeyTranslucent;
+		}
+		batchPolygon(key, 0, vertices, verticesCount, 0, rgba);
+		return;
+	}
+	if (lightFlatColor) {
+		glEnable(GL_LIGHTING);
+		glEnable(GL_COLOR_MATERIAL);
+		glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+	}
+	glColor4ub(rgba[0], rgba[1], rgba[2], rgba[3]);
 	emitTriFan3i(vertices, verticesCount);
-	if (_lighting && lightFlatColor) {
+	if (lightFlatColor) {
 		glDisable(GL_COLOR_MATERIAL);
 		glDisable(GL_LIGHTING);
 	}
@@ -290,12 +640,20 @@ void Render::drawPolygonFlat(const Vertex *vertices, int verticesCount, int colo
 
 void Render::drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey) {
 	assert(vertices && verticesCount >= 4);
-	glColor4ub(255, 255, 255, 255);
-	glEnable(GL_TEXTURE_2D);
 	Texture *t = _textureCache.getCachedTexture(texKey, texData, texW, texH);
-	glBindTexture(GL_TEXTURE_2D, t->id);
+	if (_interpolation && !_recorder.replaying) {
+		// the texture is uploaded now, the data may not be valid when replayed
+		RenderCommand *cmd = recordCommand(kRenderCmd_PolygonTexture, vertices, verticesCount);
+		cmd->args[0] = primitive;
+		cmd->args[1] = texW;
+		cmd->args[2] = texH;
+		cmd->args[3] = texKey;
+		return;
+	}
 	const GLfloat tx = t->u;
 	const GLfloat ty = t->v;
+	GLfloat uv[8];
+	int count = 4;
 	switch (primitive) {
 	case 0:
 	case 2:
@@ -304,10 +662,7 @@ void Render::drawPolygonTexture(const Vertex *vertices, int verticesCount, int p
 		// :   :
 		// 4:::3
 		//
-		{
-			GLfloat uv[] = { 0., 0., tx, 0., tx, ty, 0., ty };
-			emitQuadTex3i(vertices, uv);
-		}
+		setTexCoords(uv, 0., 0., tx, 0., tx, ty, 0., ty);
 		break;
 	case 1:
 		//
@@ -315,10 +670,8 @@ void Render::drawPolygonTexture(const Vertex *vertices, int verticesCount, int p
 		//  : :
 		// 3:::2
 		//
-		{
-			GLfloat uv[] = { tx / 2, 0., tx, ty, 0., ty };
-			emitTriTex3i(vertices, uv);
-		}
+		setTexCoords(uv, tx / 2, 0., tx, ty, 0., ty);
+		count = 3;
 		break;
 	case 3:
 	case 5:
@@ -327,10 +680,7 @@ void Render::drawPolygonTexture(const Vertex *vertices, int verticesCount, int p
 		// :   :
 		// 3:::2
 		//
-		{
-			GLfloat uv[] = { tx, 0., tx, ty, 0., ty, 0., 0. };
-			emitQuadTex3i(vertices, uv);
-		}
+		setTexCoords(uv, tx, 0., tx, ty, 0., ty, 0., 0.);
 		break;
 	case 4:
 		//
@@ -338,10 +688,8 @@ void Render::drawPolygonTexture(const Vertex *vertices, int verticesCount, int p
 		//  : :
 		// 2:::1
 		//
-		{
-			GLfloat uv[] = { tx, ty, 0., ty, tx / 2, 0. };
-			emitTriTex3i(vertices, uv);
-		}
+		setTexCoords(uv, tx, ty, 0., ty, tx / 2, 0.);
+		count = 3;
 		break;
 	case 6:
 	case 8:
@@ -350,10 +698,7 @@ void Render::drawPolygonTexture(const Vertex *vertices, int verticesCount, int p
 		// :   :
 		// 2:::1
 		//
-		{
-			GLfloat uv[] = { tx, ty, 0., ty, 0., 0., tx, 0. };
-			emitQuadTex3i(vertices, uv);
-		}
+		setTexCoords(uv, tx, ty, 0., ty, 0., 0., tx, 0.);
 		break;
 	case 7:
 		//
@@ -361,10 +706,8 @@ void Render::drawPolygonTexture(const Vertex *vertices, int verticesCount, int p
 		//  : :
 		// 1:::3
 		//
-		{
-			GLfloat uv[] = { .0, ty, tx / 2, 0., tx, ty };
-			emitTriTex3i(vertices, uv);
-		}
+		setTexCoords(uv, .0, ty, tx / 2, 0., tx, ty);
+		count = 3;
 		break;
 	case 9:
 	case 10:
@@ -373,65 +716,149 @@ void Render::drawPolygonTexture(const Vertex *vertices, int verticesCount, int p
 		// :   :
 		// 1:::4
 		//
-		{
-			GLfloat uv[] = { 0., 0., 0., ty, tx, ty, tx, 0. };
-			emitQuadTex3i(vertices, uv);
-		}
+		setTexCoords(uv, 0., 0., 0., ty, tx, ty, tx, 0.);
 		break;
 	default:
 		warning("Render::drawPolygonTexture() unhandled primitive %d", primitive);
-		break;
+		return;
 	}
+	for (int i = 0; i < count; ++i) {
+		uv[i * 2] += t->u0;
+		uv[i * 2 + 1] += t->v0;
+	}
+	if (_batching) {
+		static const GLubyte white[4] = { 255, 255, 255, 255 };
+		batchPolygon(t->id << 1, t, vertices, count, uv, white);
+		return;
+	}
+	glColor4ub(255, 255, 255, 255);
+	glEnable(GL_TEXTURE_2D);
+	_textureCache.bindTexture(t);
+	if (count == 4) {
+		emitQuadTex3i(vertices, uv);
+	} else {
+		emitTriTex3i(vertices, uv);
+	}
+	_textureCache.unbindTexture(t);
 	glDisable(GL_TEXTURE_2D);
 }
 
-void Render::drawParticle(const Vertex *pos, int color) {
+static bool getParticleColor(int color, const uint8_t *clut, GLubyte *rgba) {
 	switch (color) {
 	case kFlatColorRed:
-		glColor4ub(255, 0, 0, 127);
+		rgba[0] = 255; rgba[1] = 0; rgba[2] = 0; rgba[3] = 127;
 		break;
 	case kFlatColorGreen:
-		glColor4ub(0, 255, 0, 127);
+		rgba[0] = 0; rgba[1] = 255; rgba[2] = 0; rgba[3] = 127;
 		break;
 	case kFlatColorYellow:
-		glColor4ub(255, 255, 0, 127);
+		rgba[0] = 255; rgba[1] = 255; rgba[2] = 0; rgba[3] = 127;
 		break;
 	case kFlatColorBlue:
-		glColor4ub(0, 0, 255, 127);
+		rgba[0] = 0; rgba[1] = 0; rgba[2] = 255; rgba[3] = 127;
 		break;
 	case kFlatColorShadow:
-		glColor4ub(0, 0, 0, 127);
+		rgba[0] = 0; rgba[1] = 0; rgba[2] = 0; rgba[3] = 127;
 		break;
 	case kFlatColorLight:
-		glColor4ub(255, 255, 255, 63);
+		rgba[0] = 255; rgba[1] = 255; rgba[2] = 255; rgba[3] = 63;
 		break;
 	case kFlatColorLight9:
-		glColor4ub(255, 255, 255, 127);
+		rgba[0] = 255; rgba[1] = 255; rgba[2] = 255; rgba[3] = 127;
 		break;
 	default:
 		if (color >= 0 && color < 256) {
-			glColor4ub(_clut[color * 3], _clut[color * 3 + 1], _clut[color * 3 + 2], color == 0 ? 0 : 255);
+			rgba[0] = clut[color * 3];
+			rgba[1] = clut[color * 3 + 1];
+			rgba[2] = clut[color * 3 + 2];
+			rgba[3] = (color == 0) ? 0 : 255;
 		} else {
-			warning("Render::drawParticle() unhandled color %d", color);
+			warning("Render::drawParticles() unhandled color %d", color);
+			return false;
+		}
+	}
+	return true;
+}
+
+void Render::drawParticles(const Vertex *pos, const int *colors, int count) {
+	if (_interpolation && !_recorder.replaying) {
+		// the colors are recorded in the unused normals
+		recordCommand(kRenderCmd_Particles, pos, count);
+		RenderFrame *f = &_recorder.frames[0];
+		Vertex *v = f->vertices + f->verticesCount - count;
+		for (int i = 0; i < count; ++i) {
+			v[i].nx = colors[i];
+		}
+		return;
+	}
+	drawPoints(pos, colors, 1, count);
+}
+
+void Render::drawPoints(const Vertex *pos, const int *colors, int colorsStride, int count) {
+	if (count > _points.size) {
+		_points.size = count;
+		free(_points.vertices);
+		_points.vertices = (GLfloat *)malloc(count * 3 * sizeof(GLfloat));
+		free(_points.rgba);
+		_points.rgba = (GLubyte *)malloc(count * 4);
+		if (!_points.vertices || !_points.rgba) {
+			error("Unable to allocate %d points", count);
+		}
+	}
+	int pointsCount = 0;
+	for (int i = 0; i < count; ++i) {
+		if (getParticleColor(colors[i * colorsStride], _clut, _points.rgba + pointsCount * 4)) {
+			GLfloat *v = _points.vertices + pointsCount * 3;
+			v[0] = pos[i].x;
+			v[1] = pos[i].y;
+			v[2] = pos[i].z;
+			++pointsCount;
 		}
 	}
-	glPointSize(4.);
-	emitPoint3i(pos);
-	glPointSize(1.);
+	flushBatch();
+	if (pointsCount != 0) {
+		// a single draw call for all the points, sharing the blend state
+		glPointSize(4.);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(3, GL_FLOAT, 0, _points.vertices);
+		glColorPointer(4, GL_UNSIGNED_BYTE, 0, _points.rgba);
+		glDrawArrays(GL_POINTS, 0, pointsCount);
+		glDisableClientState(GL_COLOR_ARRAY);
+#ifndef USE_GLES
+		glDisableClientState(GL_VERTEX_ARRAY);
+#endif
+		glPointSize(1.);
+	}
 }
 
 void Render::drawSprite(int x, int y, const uint8_t *texData, int texW, int texH, int primitive, int16_t texKey, uint8_t transparentScale) {
+	if (_interpolation && !_recorder.replaying) {
+		_textureCache.getCachedTexture(texKey, texData, texW, texH);
+		RenderCommand *cmd = recordCommand(kRenderCmd_Sprite);
+		cmd->args[0] = x;
+		cmd->args[1] = y;
+		cmd->args[2] = texW;
+		cmd->args[3] = texH;
+		cmd->args[4] = primitive;
+		cmd->args[5] = texKey;
+		cmd->args[6] = transparentScale;
+		return;
+	}
+	flushBatch();
 	glColor4ub(255, 255, 255, transparentScale);
 	glEnable(GL_TEXTURE_2D);
 	Texture *t = _textureCache.getCachedTexture(texKey, texData, texW, texH);
-	glBindTexture(GL_TEXTURE_2D, t->id);
+	_textureCache.bindTexture(t);
 	switch (primitive) {
 	case 0:
 		// 1:::2
 		// :   :
 		// 4:::3
 		{
-			GLfloat uv[] = { 0., 0., t->u, 0., t->u, t->v, 0., t->v };
+			const GLfloat u0 = t->u0, u1 = t->u0 + t->u;
+			const GLfloat v0 = t->v0, v1 = t->v0 + t->v;
+			GLfloat uv[] = { u0, v0, u1, v0, u1, v1, u0, v1 };
 			emitQuadTex2i(x, y, texW, texH, uv);
 		}
 		break;
@@ -442,7 +869,9 @@ void Render::drawSprite(int x, int y, const uint8_t *texData, int texW, int texH
 		// 1:::4
 		//
 		{
-			GLfloat uv[] = { 0., 0., 0., t->v, t->u, t->v, t->u, 0. };
+			const GLfloat u0 = t->u0, u1 = t->u0 + t->u;
+			const GLfloat v0 = t->v0, v1 = t->v0 + t->v;
+			GLfloat uv[] = { u0, v0, u0, v1, u1, v1, u1, v0 };
 			emitQuadTex2i(x, y, texW, texH, uv);
 		}
 		break;
@@ -450,11 +879,22 @@ void Render::drawSprite(int x, int y, const uint8_t *texData, int texW, int texH
 		warning("Render::drawSprite() unhandled primitive %d", primitive);
 		break;
 	}
+	_textureCache.unbindTexture(t);
 	glDisable(GL_TEXTURE_2D);
 }
 
 void Render::drawRectangle(int x, int y, int w, int h, int color) {
 	assert(color >= 0 && color < 256);
+	if (_interpolation && !_recorder.replaying) {
+		RenderCommand *cmd = recordCommand(kRenderCmd_Rectangle);
+		cmd->args[0] = x;
+		cmd->args[1] = y;
+		cmd->args[2] = w;
+		cmd->args[3] = h;
+		cmd->args[4] = color;
+		return;
+	}
+	flushBatch();
 	glColor4ub(_clut[color * 3], _clut[color * 3 + 1], _clut[color * 3 + 2], color == 0 ? 0 : 255);
 	emitQuad2i(x, y, w, h);
 }
@@ -473,7 +913,12 @@ void Render::copyToOverlay(int x, int y, int w, int h, const uint8_t *data, bool
 }
 
 void Render::setIgnoreDepth(bool ignoreDepth) {
+	if (_interpolation && !_recorder.replaying) {
+		recordCommand(kRenderCmd_SetIgnoreDepth)->args[0] = ignoreDepth;
+		return;
+	}
 	if (_drawObjectIgnoreDepth != ignoreDepth) {
+		flushBatch();
 		if (ignoreDepth) {
 			glDisable(GL_DEPTH_TEST);
 		} else {
@@ -483,15 +928,44 @@ void Render::setIgnoreDepth(bool ignoreDepth) {
 	}
 }
 
-void Render::beginObjectDraw(int x, int y, int z, int ry, int shift) {
-	glPushMatrix();
+void Render::beginObjectDraw(int x, int y, int z, int ry, int shift, int key) {
+	if (_interpolation && !_recorder.replaying) {
+		RenderCommand *cmd = recordCommand(kRenderCmd_BeginObjectDraw);
+		cmd->args[0] = x;
+		cmd->args[1] = y;
+		cmd->args[2] = z;
+		cmd->args[3] = ry;
+		cmd->args[4] = shift;
+		cmd->args[5] = key;
+		return;
+	}
 	const GLfloat div = 1 << shift;
+	if (_batching) {
+		assert(!_batch.objectDraw);
+		_batch.objectDraw = true;
+		_batch.tx = x / div;
+		_batch.ty = y / div;
+		_batch.tz = z / div;
+		const double a = ry * 2 * M_PI / 1024.;
+		_batch.cosRy = cos(a);
+		_batch.sinRy = sin(a);
+		return;
+	}
+	glPushMatrix();
 	glTranslatef(x / div, y / div, z / div);
 	glRotatef(ry * 360 / 1024., 0., 1., 0.);
 	glScalef(1 / 8., 1 / 2., 1 / 8.);
 }
 
 void Render::endObjectDraw() {
+	if (_interpolation && !_recorder.replaying) {
+		recordCommand(kRenderCmd_EndObjectDraw);
+		return;
+	}
+	if (_batching) {
+		_batch.objectDraw = false;
+		return;
+	}
 	glPopMatrix();
 }
 
@@ -502,6 +976,7 @@ void Render::setOverlayBlendColor(int r, int g, int b) {
 }
 
 void Render::resizeOverlay(int w, int h, bool rgb, int displayWidth, int displayHeight) {
+	flushBatch();
 	if (w != _overlay.w || h != _overlay.h || rgb != _overlay.rgbTex) {
 		if (_overlay.tex) {
 			_textureCache.destroyTexture(_overlay.tex);
@@ -538,10 +1013,16 @@ void Render::setPalette(const uint8_t *pal, int offset, int count) {
 		_clut[color + 2] = b;
 		color += 3;
 	}
+	flushBatch();
 	_textureCache.setPalette(_clut);
 }
 
 void Render::clearScreen() {
+	if (_interpolation && !_recorder.replaying) {
+		recordCommand(kRenderCmd_ClearScreen);
+		return;
+	}
+	flushBatch();
 	glClearColor(0, 0, 0, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 #ifdef USE_GLES
@@ -559,6 +1040,16 @@ void Render::clearScreen() {
 }
 
 void Render::setupProjection(int mode) {
+	if (_interpolation && !_recorder.replaying) {
+		RenderCommand *cmd = recordCommand(kRenderCmd_SetupProjection);
+		cmd->args[0] = mode;
+		cmd->camera[0] = _cameraPos.x;
+		cmd->camera[1] = _cameraPos.y;
+		cmd->camera[2] = _cameraPos.z;
+		cmd->camera[3] = _cameraPitch;
+		return;
+	}
+	flushBatch();
 	const GLfloat aspect = 1.5 * _aspectRatio;
 
 	switch (mode) {
@@ -652,6 +1143,7 @@ void Render::setupProjection(int mode) {
 }
 
 void Render::drawOverlay() {
+	flushBatch();
 
 	const bool hasOverlayTexture = (_overlay.tex != 0);
 	const bool hasOverlayColor = (_overlay.r != 255 || _overlay.g != 255 || _overlay.b != 255);
@@ -669,12 +1161,13 @@ void Render::drawOverlay() {
 	if (hasOverlayTexture) {
 		glColor4ub(255, 255, 255, 255);
 		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, _overlay.tex->id);
+		_textureCache.bindTexture(_overlay.tex);
 		const GLfloat tU = _overlay.tex->u;
 		const GLfloat tV = _overlay.tex->v;
 		assert(tU != 0. && tV != 0.);
 		GLfloat uv[] = { 0., 0., tU, 0., tU, tV, 0., tV };
 		emitQuadTex2i(-1, _overlay.y, 2, _overlay.h, uv);
+		_textureCache.unbindTexture(_overlay.tex);
 		glDisable(GL_TEXTURE_2D);
 	}
 	if (hasOverlayColor) {
@@ -696,6 +1189,7 @@ void Render::drawOverlay() {
 }
 
 const uint8_t *Render::captureScreen(int *w, int *h) {
+	flushBatch();
 	if (!_screenshotBuf) {
 		_screenshotBuf = (uint8_t *)calloc(_w * _h, 4);
 	}
@@ -706,3 +1200,114 @@ const uint8_t *Render::captureScreen(int *w, int *h) {
 	}
 	return _screenshotBuf;
 }
+
+void Render::beginFrame() {
+	if (_interpolation) {
+		SWAP(_recorder.frames[0], _recorder.frames[1]);
+		_recorder.frames[0].commandsCount = 0;
+		_recorder.frames[0].verticesCount = 0;
+		_recorder.frames[0].objectsCount = 0;
+		_recorder.matched = false;
+		// the textures are not referenced by the previous tick commands
+		_textureCache.evictTextures(0);
+	}
+}
+
+void Render::replayFrame(int alpha) {
+	if (!_interpolation) {
+		return;
+	}
+	if (!_recorder.matched) {
+		matchRecordedCommands();
+		_recorder.matched = true;
+	}
+	const Vertex3f cameraPos = _cameraPos;
+	const GLfloat cameraPitch = _cameraPitch;
+	_recorder.replaying = true;
+	const RenderFrame *cur = &_recorder.frames[0];
+	const RenderFrame *prev = &_recorder.frames[1];
+	for (int i = 0; i < cur->commandsCount; ++i) {
+		const RenderCommand *cmd = &cur->commands[i];
+		const Vertex *vertices = cur->vertices + cmd->first;
+		const int *args = cmd->args;
+		switch (cmd->type) {
+		case kRenderCmd_ClearScreen:
+			clearScreen();
+			break;
+		case kRenderCmd_SetupProjection:
+			_cameraPos.x = cmd->camera[0];
+			_cameraPos.y = cmd->camera[1];
+			_cameraPos.z = cmd->camera[2];
+			_cameraPitch = cmd->camera[3];
+			if (cmd->prev != -1) {
+				const GLfloat *p = prev->commands[cmd->prev].camera;
+				if (fabs(_cameraPos.x - p[0]) < kInterpolateDistanceMax && fabs(_cameraPos.z - p[2]) < kInterpolateDistanceMax) {
+					const GLfloat t = alpha / 256.;
+					_cameraPos.x = p[0] + (_cameraPos.x - p[0]) * t;
+					_cameraPos.y = p[1] + (_cameraPos.y - p[1]) * t;
+					_cameraPos.z = p[2] + (_cameraPos.z - p[2]) * t;
+					GLfloat da = _cameraPitch - p[3];
+					if (da > 180.) {
+						da -= 360.;
+					} else if (da < -180.) {
+						da += 360.;
+					}
+					_cameraPitch = p[3] + da * t;
+				}
+			}
+			setupProjection(args[0]);
+			break;
+		case kRenderCmd_SetIgnoreDepth:
+			setIgnoreDepth(args[0] != 0);
+			break;
+		case kRenderCmd_BeginObjectDraw: {
+				int x = args[0];
+				int y = args[1];
+				int z = args[2];
+				int ry = args[3];
+				if (cmd->prev != -1) {
+					const int *p = prev->commands[cmd->prev].args;
+					const int distanceMax = kInterpolateDistanceMax << args[4];
+					if (p[4] == args[4] && ABS(x - p[0]) < distanceMax && ABS(z - p[2]) < distanceMax) {
+						x = interpolate(p[0], x, alpha);
+						y = interpolate(p[1], y, alpha);
+						z = interpolate(p[2], z, alpha);
+						int da = (ry - p[3]) & 1023;
+						if (da >= 512) {
+							da -= 1024;
+						}
+						ry = p[3] + da * alpha / 256;
+					}
+				}
+				beginObjectDraw(x, y, z, ry, args[4], args[5]);
+			}
+			break;
+		case kRenderCmd_EndObjectDraw:
+			endObjectDraw();
+			break;
+		case kRenderCmd_PolygonFlat:
+			drawPolygonFlat(vertices, cmd->count, args[0]);
+			break;
+		case kRenderCmd_PolygonTexture:
+			if (_textureCache.hasTexture(args[3])) {
+				drawPolygonTexture(vertices, cmd->count, args[0], 0, args[1], args[2], args[3]);
+			}
+			break;
+		case kRenderCmd_Particles:
+			drawPoints(vertices, &vertices[0].nx, sizeof(Vertex) / sizeof(int), cmd->count);
+			break;
+		case kRenderCmd_Sprite:
+			if (_textureCache.hasTexture(args[5])) {
+				drawSprite(args[0], args[1], 0, args[2], args[3], args[4], args[5], args[6]);
+			}
+			break;
+		case kRenderCmd_Rectangle:
+			drawRectangle(args[0], args[1], args[2], args[3], args[4]);
+			break;
+		}
+	}
+	flushBatch();
+	_recorder.replaying = false;
+	_cameraPos = cameraPos;
+	_cameraPitch = cameraPitch;
+}
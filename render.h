@@ -26,12 +26,17 @@ enum {
 };
 
 struct Texture;
+struct TextureCacheStats;
 
 struct RenderParams {
 	bool fog;
 	bool gouraud; // enable lighting
 	const char *textureFilter;
 	const char *textureScaler;
+	int textureCacheSize; // in megabytes, 0 for unlimited
+	bool batching; // queue polygons and submit them with vertex arrays
+	bool gpuPalette; // palette lookup done by a fragment shader
+	bool interpolation; // record the draw calls of a tick, replayed on each display frame
 };
 
 struct Render {
@@ -56,6 +61,8 @@ struct Render {
 	int _paletteRgbScale;
 	bool _fog;
 	bool _lighting;
+	bool _batching;
+	bool _interpolation;
 	bool _drawObjectIgnoreDepth;
 	int _framesCount;
 	int _framesPerSec;
@@ -75,15 +82,20 @@ struct Render {
 	void prepareTextureLut(const uint8_t *data, int w, int h, const uint8_t *clut, int16_t texKey);
 	void prepareTextureRgb(const uint8_t *data, int w, int h, int16_t texKey);
 	void releaseTexture(int16_t texKey);
+	void beginTextureAtlas();
+	void addToTextureAtlas(const uint8_t *data, int w, int h, int16_t texKey);
+	void endTextureAtlas();
+	void getTextureCacheStats(TextureCacheStats *stats) const;
 
 	void drawPolygonFlat(const Vertex *vertices, int verticesCount, int color);
 	void drawPolygonTexture(const Vertex *vertices, int verticesCount, int primitive, const uint8_t *texData, int texW, int texH, int16_t texKey);
-	void drawParticle(const Vertex *pos, int color);
+	void drawParticles(const Vertex *pos, const int *colors, int count);
+	void drawPoints(const Vertex *pos, const int *colors, int colorsStride, int count);
 	void drawSprite(int x, int y, const uint8_t *texData, int texW, int texH, int primitive, int16_t texKey, uint8_t transparentScale = 255);
 	void drawRectangle(int x, int y, int w, int h, int color);
 
 	void setIgnoreDepth(bool ignoreDepth);
-	void beginObjectDraw(int x, int y, int z, int ry, int shift = 0);
+	void beginObjectDraw(int x, int y, int z, int ry, int shift = 0, int key = -1);
 	void endObjectDraw();
 
 	void setOverlayBlendColor(int r, int g, int b);
@@ -98,6 +110,9 @@ struct Render {
 	void resizeScreen(int w, int h, float *p, int fov);
 
 	const uint8_t *captureScreen(int *w, int *h);
+
+	void beginFrame();
+	void replayFrame(int alpha);
 };
 
 #endif // RENDER_H__
@@ -4,7 +4,9 @@
  */
 
 #include <math.h>
+#include <SDL.h>
 #include "file.h"
+#include "trace.h"
 #include "trigo.h"
 #include "resource.h"
 
@@ -19,9 +21,13 @@ static char _languagesPsx[] = {
 
 static const bool kLoadPsxData = false;
 
+static const bool kMapLevelData = true;
+
 Resource::Resource() {
 	memset(_treesTable, 0, sizeof(_treesTable));
 	memset(_treesTableCount, 0, sizeof(_treesTableCount));
+	memset(_treesMapData, 0, sizeof(_treesMapData));
+	memset(_treesMapSize, 0, sizeof(_treesMapSize));
 	_msgOffsetsTableCount = 0;
 	_msgOffsetsTable = 0;
 	_msgData = 0;
@@ -57,10 +63,15 @@ Resource::Resource() {
 	memset(_sonOffsetsTable, 0, sizeof(_sonOffsetsTable));
 	_fileSon = 0;
 	_psxCmdData = false;
+	_stagingRes = 0;
+	_stagingThread = 0;
+	_stagingLevel = -1;
 }
 
 Resource::~Resource() {
 	// TODO - reclaimed by the OS when the program exits
+	waitPrefetchLevelData();
+	delete _stagingRes;
 }
 
 void Resource::loadCMD(File *fp, int dataSize) {
@@ -455,7 +466,41 @@ static const struct {
 	{ "msg", &Resource::loadMSG }
 };
 
-void Resource::loadLevelData(int levelNum) {
+void Resource::freeTreeNodeData(int type, ResTreeNode *node) {
+	uint8_t *mapData = _treesMapData[type];
+	if (node->data && !(mapData && node->data >= mapData && node->data < mapData + _treesMapSize[type])) {
+		free(node->data);
+	}
+	node->data = 0;
+}
+
+void Resource::unloadTree(int type) {
+	for (uint32_t j = 0; j < _treesTableCount[type]; ++j) {
+		ResTreeNode *node = &_treesTable[type][j];
+		freeTreeNodeData(type, node);
+		memset(node, 0, sizeof(ResTreeNode));
+	}
+	free(_treesTable[type]);
+	_treesTable[type] = 0;
+	_treesTableCount[type] = 0;
+	fileUnmap(_treesMapData[type], _treesMapSize[type]);
+	_treesMapData[type] = 0;
+	_treesMapSize[type] = 0;
+}
+
+static bool closeLevelDataFile(File *fp, const char *filename) {
+	// the read errors are only returned when not exiting, see prefetchLevelDataThread()
+	const bool ioError = fileIoError(fp);
+	fileClose(fp);
+	if (ioError) {
+		warning("I/O error reading '%s'", filename);
+		return false;
+	}
+	return true;
+}
+
+bool Resource::loadLevelData(int levelNum, bool background) {
+	TraceZone zone("Resource::loadLevelData");
 	File *fp;
 	int dataSize;
 	char filename[32];
@@ -464,18 +509,35 @@ void Resource::loadLevelData(int levelNum) {
 	for (uint32_t i = 0; i < ARRAYSIZE(_resLoadDataTable); ++i) {
 		snprintf(filename, sizeof(filename), "%s.%s", levelName, _resLoadDataTable[i].ext);
 		int type = _resLoadDataTable[i].type;
-		fp = fileOpen(filename, &dataSize, kFileType_DATA);
-		uint32_t count = fileReadUint32LE(fp);
-
-		debug(kDebug_RESOURCE, "Resource::loadLevelData() file '%s' type %d count %d", filename, type, count);
+		fp = fileOpen(filename, &dataSize, kFileType_DATA, !background);
+		if (!fp) {
+			return false;
+		}
 
 		// free previously loaded data
-		for (uint32_t j = 0; j < _treesTableCount[type]; ++j) {
-			ResTreeNode *node = &_treesTable[type][j];
-			free(node->data);
-			memset(node, 0, sizeof(ResTreeNode));
+		unloadTree(type);
+
+		// the nodes data point to the mapped file, the demo conversions write to copy-on-write pages
+		uint8_t *mapData = kMapLevelData ? fileMap(fp, dataSize) : 0;
+		const uint8_t *index = mapData;
+		uint32_t count;
+		if (mapData) {
+			_treesMapData[type] = mapData;
+			_treesMapSize[type] = dataSize;
+			count = READ_LE_UINT32(index); index += 4;
+			if (4 + count * 12 > (uint32_t)dataSize) {
+				if (background) {
+					warning("Invalid index count %d for '%s'", count, filename);
+					fileClose(fp);
+					return false;
+				}
+				error("Invalid index count %d for '%s'", count, filename);
+			}
+		} else {
+			count = fileReadUint32LE(fp);
 		}
-		free(_treesTable[type]);
+
+		debug(kDebug_RESOURCE, "Resource::loadLevelData() file '%s' type %d count %d mapped %d", filename, type, count, mapData != 0);
 
 		// load new level data
 		_treesTable[type] = ALLOC<ResTreeNode>(count);
@@ -483,34 +545,59 @@ void Resource::loadLevelData(int levelNum) {
 		for (uint32_t j = 0; j < count; ++j) {
 			ResTreeNode *node = &_treesTable[type][j];
 			memset(node, 0, sizeof(ResTreeNode));
-			const uint32_t offs = fileReadUint32LE(fp);
-			const uint32_t size = fileReadUint32LE(fp);
-			node->childKey = fileReadUint16LE(fp);
-			node->nextKey = fileReadUint16LE(fp);
+			uint32_t offs, size;
+			if (mapData) {
+				offs = READ_LE_UINT32(index);
+				size = READ_LE_UINT32(index + 4);
+				node->childKey = READ_LE_UINT16(index + 8);
+				node->nextKey = READ_LE_UINT16(index + 10);
+				index += 12;
+			} else {
+				offs = fileReadUint32LE(fp);
+				size = fileReadUint32LE(fp);
+				node->childKey = fileReadUint16LE(fp);
+				node->nextKey = fileReadUint16LE(fp);
+			}
 			node->dataOffset = 4 + count * 12 + offs;
 			node->dataSize = size;
 		}
 		for (uint32_t j = 0; j < count; ++j) {
 			ResTreeNode *node = &_treesTable[type][j];
 			if (node->dataSize != 0) {
-				node->data = (uint8_t *)malloc(node->dataSize);
-				if (node->data) {
-					fileSetPos(fp, node->dataOffset, kFilePosition_SET);
-					fileRead(fp, node->data, node->dataSize);
-					if (g_isDemo && _resLoadDataTable[i].convert) {
-						node->data = _resLoadDataTable[i].convert(node->data, &node->dataSize);
+				if (mapData) {
+					if (node->dataOffset + node->dataSize > (uint32_t)dataSize) {
+						warning("Invalid data offset 0x%x size %d for '%s' node %d", node->dataOffset, node->dataSize, filename, j);
+						node->dataSize = 0;
+						continue;
+					}
+					node->data = mapData + node->dataOffset;
+				} else {
+					node->data = (uint8_t *)malloc(node->dataSize);
+					if (node->data) {
+						fileSetPos(fp, node->dataOffset, kFilePosition_SET);
+						fileRead(fp, node->data, node->dataSize);
 					}
 				}
+				if (node->data && g_isDemo && _resLoadDataTable[i].convert) {
+					node->data = _resLoadDataTable[i].convert(node->data, &node->dataSize);
+				}
 			}
 		}
-		fileClose(fp);
+		if (!closeLevelDataFile(fp, filename)) {
+			return false;
+		}
 	}
 
 	for (uint32_t i = 0; i < ARRAYSIZE(_resLoadDataTable2); ++i) {
 		snprintf(filename, sizeof(filename), "level%d.%s", levelNum + 1, _resLoadDataTable2[i].ext);
-		fp = fileOpen(filename, &dataSize, kFileType_DATA);
+		fp = fileOpen(filename, &dataSize, kFileType_DATA, !background);
+		if (!fp) {
+			return false;
+		}
 		(this->*_resLoadDataTable2[i].LoadData)(fp, dataSize);
-		fileClose(fp);
+		if (!closeLevelDataFile(fp, filename)) {
+			return false;
+		}
 	}
 
 	_conradVoiceCmdNum = -1;
@@ -519,33 +606,159 @@ void Resource::loadLevelData(int levelNum) {
 	_lastObjectKey = -1;
 
 	snprintf(filename, sizeof(filename), "%s.env", levelName);
-	fp = fileOpen(filename, &dataSize, kFileType_DATA);
+	fp = fileOpen(filename, &dataSize, kFileType_DATA, !background);
+	if (!fp) {
+		return false;
+	}
 	loadENV(fp, dataSize);
-	fileClose(fp);
+	if (!closeLevelDataFile(fp, filename)) {
+		return false;
+	}
 
 	snprintf(filename, sizeof(filename), "%s.ini", levelName);
-	fp = fileOpen(filename, &dataSize, kFileType_DATA);
+	fp = fileOpen(filename, &dataSize, kFileType_DATA, !background);
+	if (!fp) {
+		return false;
+	}
 	loadKeyPaths(fp, dataSize);
-	fileClose(fp);
+	if (!closeLevelDataFile(fp, filename)) {
+		return false;
+	}
 
 	snprintf(filename, sizeof(filename), "%s.snt", levelName);
-	fp = fileOpen(filename, &dataSize, kFileType_TEXT);
+	fp = fileOpen(filename, &dataSize, kFileType_TEXT, !background);
+	if (!fp) {
+		return false;
+	}
 	loadObjectIndexes(fp, dataSize);
-	fileClose(fp);
+	if (!closeLevelDataFile(fp, filename)) {
+		return false;
+	}
 
 	snprintf(filename, sizeof(filename), "%s.dtt", levelName);
-	fp = fileOpen(filename, &dataSize, kFileType_TEXT);
+	fp = fileOpen(filename, &dataSize, kFileType_TEXT, !background);
+	if (!fp) {
+		return false;
+	}
 	loadObjectText(fp, dataSize, levelNum + 1);
-	fileClose(fp);
+	if (!closeLevelDataFile(fp, filename)) {
+		return false;
+	}
+	return true;
+}
+
+void Resource::unloadLevelData() {
+	for (int type = 0; type < kResTypeCount; ++type) {
+		unloadTree(type);
+	}
+	free(_cmdOffsetsTable);
+	_cmdOffsetsTable = 0;
+	_cmdOffsetsTableCount = 0;
+	free(_cmdData);
+	_cmdData = 0;
+	free(_msgOffsetsTable);
+	_msgOffsetsTable = 0;
+	_msgOffsetsTableCount = 0;
+	free(_msgData);
+	_msgData = 0;
+	free(_envAniData);
+	_envAniData = 0;
+	_envAniDataCount = 0;
+	free(_objectIndexesTable);
+	_objectIndexesTable = 0;
+	_objectIndexesTableCount = 0;
+	free(_objectTextData);
+	_objectTextData = 0;
+	_objectTextDataSize = 0;
+	_keyPathsTableCount = 0;
+}
+
+void Resource::swapLevelData(Resource *res) {
+	for (int type = 0; type < kResTypeCount; ++type) {
+		SWAP(_treesTable[type], res->_treesTable[type]);
+		SWAP(_treesTableCount[type], res->_treesTableCount[type]);
+		SWAP(_treesMapData[type], res->_treesMapData[type]);
+		SWAP(_treesMapSize[type], res->_treesMapSize[type]);
+	}
+	SWAP(_msgOffsetsTableCount, res->_msgOffsetsTableCount);
+	SWAP(_msgOffsetsTable, res->_msgOffsetsTable);
+	SWAP(_msgData, res->_msgData);
+	SWAP(_cmdOffsetsTableCount, res->_cmdOffsetsTableCount);
+	SWAP(_cmdOffsetsTable, res->_cmdOffsetsTable);
+	SWAP(_cmdData, res->_cmdData);
+	SWAP(_objectIndexesTableCount, res->_objectIndexesTableCount);
+	SWAP(_objectIndexesTable, res->_objectIndexesTable);
+	SWAP(_objectTextDataSize, res->_objectTextDataSize);
+	SWAP(_objectTextData, res->_objectTextData);
+	SWAP(_keyPathsTableCount, res->_keyPathsTableCount);
+	for (int i = 0; i < kKeyPathsTableSize; ++i) {
+		SWAP(_keyPathsTable[i], res->_keyPathsTable[i]);
+	}
+	SWAP(_envAniDataCount, res->_envAniDataCount);
+	SWAP(_envAniData, res->_envAniData);
+	SWAP(_conradVoiceCmdNum, res->_conradVoiceCmdNum);
+	_lastObjectKey = -1;
+}
+
+static int prefetchLevelDataThread(void *data) {
+	Resource *res = (Resource *)data;
+	// the errors are reported by the main thread, from loadPrefetchedLevelData()
+	fileSetExitOnError(false);
+	res->_stagingRes->unloadLevelData();
+	return res->_stagingRes->loadLevelData(res->_stagingLevel, true) ? 0 : -1;
+}
+
+void Resource::prefetchLevelData(int levelNum) {
+	waitPrefetchLevelData();
+	if (levelNum < 0 || levelNum >= kLevelDescriptionsCount || !_levelDescriptionsTable[levelNum].name[0]) {
+		return;
+	}
+	if (!_stagingRes) {
+		_stagingRes = new Resource;
+	}
+	memcpy(_stagingRes->_levelDescriptionsTable, _levelDescriptionsTable, sizeof(_levelDescriptionsTable));
+	_stagingLevel = levelNum;
+	_stagingThread = SDL_CreateThread(prefetchLevelDataThread, "prefetchLevelData", this);
+	if (!_stagingThread) {
+		warning("Unable to create level data loading thread");
+		_stagingLevel = -1;
+	}
+	debug(kDebug_RESOURCE, "Resource::prefetchLevelData() level %d", levelNum);
+}
+
+void Resource::waitPrefetchLevelData() {
+	if (_stagingThread) {
+		int status = 0;
+		SDL_WaitThread(_stagingThread, &status);
+		_stagingThread = 0;
+		if (status != 0) {
+			warning("Unable to load level %d data in the background", _stagingLevel);
+			_stagingRes->unloadLevelData();
+			_stagingLevel = -1;
+		}
+	}
+}
+
+bool Resource::loadPrefetchedLevelData(int levelNum) {
+	waitPrefetchLevelData();
+	if (_stagingLevel == -1) {
+		return false;
+	}
+	const bool loaded = (_stagingLevel == levelNum);
+	if (loaded) {
+		swapLevelData(_stagingRes);
+	}
+	// release the previous (or unused) level data
+	_stagingRes->unloadLevelData();
+	_stagingLevel = -1;
+	debug(kDebug_RESOURCE, "Resource::loadPrefetchedLevelData() level %d loaded %d", levelNum, loaded);
+	return loaded;
 }
 
 void Resource::unload(int type, int16_t key) {
 	assert(key > 0 && key < _treesTableCount[type]);
 	ResTreeNode *node = &_treesTable[type][key];
-	if (node->data) {
-		free(node->data);
-		node->data = 0;
-	}
+	freeTreeNodeData(type, node);
 	node->dataSize = 0;
 }
 
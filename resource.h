@@ -9,6 +9,8 @@
 #include "file.h"
 #include "util.h"
 
+struct SDL_Thread;
+
 enum {
 	kResType_SPR,
 	kResType_PAL,
@@ -144,6 +146,8 @@ struct VagOffset {
 struct Resource {
 	ResTreeNode *_treesTable[kResTypeCount];
 	uint16_t _treesTableCount[kResTypeCount];
+	uint8_t *_treesMapData[kResTypeCount]; // file mapping, nodes data point into it
+	int _treesMapSize[kResTypeCount];
 	uint16_t _msgOffsetsTableCount;
 	uint16_t *_msgOffsetsTable;
 	uint8_t *_msgData;
@@ -181,11 +185,21 @@ struct Resource {
 	ResPsxOffset _dinOffsetsTable[kResPsxDinOffsetsTableSize];
 	File *_fileDin;
 	bool _psxCmdData;
+	Resource *_stagingRes; // next level data, loaded in the background
+	SDL_Thread *_stagingThread;
+	int _stagingLevel;
 
 	Resource();
 	~Resource();
 
-	void loadLevelData(int levelNum);
+	bool loadLevelData(int levelNum, bool background = false);
+	void freeTreeNodeData(int type, ResTreeNode *node);
+	void unloadTree(int type);
+	void unloadLevelData();
+	void swapLevelData(Resource *res);
+	void prefetchLevelData(int levelNum);
+	bool loadPrefetchedLevelData(int levelNum);
+	void waitPrefetchLevelData();
 	void unload(int type, int16_t key);
 	int16_t getPrevious(int type, int16_t key);
 	int16_t getNext(int type, int16_t key);
@@ -108,15 +108,6 @@ static void persistCellMap(File *fp, CellMap &m) {
 	persist<M>(fp, m.south);
 	persist<M>(fp, m.west);
 	persist<M>(fp, m.east);
-	if (M == kModeLoad) {
-		CollisionSlot *slot = m.colSlot;
-		while (slot) {
-			CollisionSlot *next = slot->next;
-			free(slot);
-			slot = next;
-		}
-		m.colSlot = 0;
-	}
 }
 
 template <int M>
@@ -305,7 +296,6 @@ static void persistGameObject(File *fp, Game &g, GameObject *o) {
 	persist<M>(fp, o->yPosWorld);
 	persist<M>(fp, o->zPosWorld);
 	if (M == kModeLoad) {
-		o->colSlot = 0;
 		const int decor = o->flags[1] & 0x100;
 		o->flags[1] &= ~0x100;
 		g._currentObject = o;
@@ -529,6 +519,10 @@ template <int M>
 static void persistGameState(File *fp, Game &g) {
 	pad<M>(fp, sizeof(uint32_t));
 	persist<M>(fp, g._room);
+	if (M == kModeLoad) {
+		// the collision slots are recreated by persistGameObject()
+		g.resetCollisionSlotsPool();
+	}
 	persistMap<M>(fp, g);
 	persistObjects<M>(fp, g);
 	persistCamera<M>(fp, g);
@@ -538,7 +532,15 @@ static void persistGameState(File *fp, Game &g) {
 	persistMusic<M>(fp, g);
 }
 
+static void checkPendingSave() {
+	// the savegames are written in the background, a failure is reported on the next save or load
+	if (!fileWaitPendingWrites()) {
+		warning("Failed to write the previous savegame");
+	}
+}
+
 bool Game::saveGameState(int num) {
+	checkPendingSave();
 	char filename[32];
 	if (num < 0) {
 		snprintf(filename, sizeof(filename), kMenuFn_s, -num, "sav");
@@ -565,6 +567,7 @@ bool Game::saveGameState(int num) {
 }
 
 bool Game::loadGameState(int num) {
+	checkPendingSave();
 	char filename[32];
 	if (num < 0) {
 		snprintf(filename, sizeof(filename), kMenuFn_s, -num, "sav");
@@ -3,8 +3,17 @@
  * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include <sys/time.h>
 #include "scaler.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SCALER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCALER_NEON
+#endif
+
 void point1x(uint16_t *dst, int dstPitch, const uint16_t *src, int srcPitch, int w, int h) {
 	while (h--) {
 		memcpy(dst, src, w * sizeof(uint16_t));
@@ -48,6 +57,137 @@ void point3x(uint16_t *dst, int dstPitch, const uint16_t *src, int srcPitch, int
 	}
 }
 
+//
+// 8 pixels at a time versions of the center pixels loops, src pointers are
+// positioned on the first pixel (E) and must allow reading one pixel before
+// and 8 pixels after.
+//
+
+#if defined(SCALER_SSE2)
+
+static inline __m128i select16(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i notEqual16(__m128i a, __m128i b) {
+	return _mm_xor_si128(_mm_cmpeq_epi16(a, b), _mm_set1_epi16(-1));
+}
+
+static void scanline2x_simd(uint16_t *dst0, uint16_t *dst1, const uint16_t *src0, const uint16_t *src1, const uint16_t *src2) {
+	const __m128i B = _mm_loadu_si128((const __m128i *)src0);
+	const __m128i D = _mm_loadu_si128((const __m128i *)(src1 - 1));
+	const __m128i E = _mm_loadu_si128((const __m128i *)src1);
+	const __m128i F = _mm_loadu_si128((const __m128i *)(src1 + 1));
+	const __m128i H = _mm_loadu_si128((const __m128i *)src2);
+	const __m128i cond = _mm_and_si128(notEqual16(B, H), notEqual16(D, F));
+	const __m128i e0 = select16(_mm_and_si128(cond, _mm_cmpeq_epi16(D, B)), D, E);
+	const __m128i e1 = select16(_mm_and_si128(cond, _mm_cmpeq_epi16(B, F)), F, E);
+	const __m128i e2 = select16(_mm_and_si128(cond, _mm_cmpeq_epi16(D, H)), D, E);
+	const __m128i e3 = select16(_mm_and_si128(cond, _mm_cmpeq_epi16(H, F)), F, E);
+	_mm_storeu_si128((__m128i *)dst0,       _mm_unpacklo_epi16(e0, e1));
+	_mm_storeu_si128((__m128i *)(dst0 + 8), _mm_unpackhi_epi16(e0, e1));
+	_mm_storeu_si128((__m128i *)dst1,       _mm_unpacklo_epi16(e2, e3));
+	_mm_storeu_si128((__m128i *)(dst1 + 8), _mm_unpackhi_epi16(e2, e3));
+}
+
+static void scanline3x_simd(uint16_t *dst0, uint16_t *dst1, uint16_t *dst2, const uint16_t *src0, const uint16_t *src1, const uint16_t *src2) {
+	const __m128i A = _mm_loadu_si128((const __m128i *)(src0 - 1));
+	const __m128i B = _mm_loadu_si128((const __m128i *)src0);
+	const __m128i C = _mm_loadu_si128((const __m128i *)(src0 + 1));
+	const __m128i D = _mm_loadu_si128((const __m128i *)(src1 - 1));
+	const __m128i E = _mm_loadu_si128((const __m128i *)src1);
+	const __m128i F = _mm_loadu_si128((const __m128i *)(src1 + 1));
+	const __m128i G = _mm_loadu_si128((const __m128i *)(src2 - 1));
+	const __m128i H = _mm_loadu_si128((const __m128i *)src2);
+	const __m128i I = _mm_loadu_si128((const __m128i *)(src2 + 1));
+	const __m128i cond = _mm_and_si128(notEqual16(B, H), notEqual16(D, F));
+	const __m128i eqDB = _mm_cmpeq_epi16(D, B);
+	const __m128i eqBF = _mm_cmpeq_epi16(B, F);
+	const __m128i eqDH = _mm_cmpeq_epi16(D, H);
+	const __m128i eqHF = _mm_cmpeq_epi16(H, F);
+	const __m128i neEA = notEqual16(E, A);
+	const __m128i neEC = notEqual16(E, C);
+	const __m128i neEG = notEqual16(E, G);
+	const __m128i neEI = notEqual16(E, I);
+	__m128i out[9];
+	out[0] = select16(_mm_and_si128(cond, eqDB), D, E);
+	out[1] = select16(_mm_and_si128(cond, _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi16(E, B), neEC), _mm_and_si128(eqBF, neEA))), B, E);
+	out[2] = select16(_mm_and_si128(cond, eqBF), F, E);
+	out[3] = select16(_mm_and_si128(cond, _mm_and_si128(eqDB, _mm_or_si128(neEG, neEA))), D, E);
+	out[4] = E;
+	out[5] = select16(_mm_and_si128(cond, _mm_or_si128(_mm_and_si128(eqBF, neEI), _mm_and_si128(eqHF, neEC))), F, E);
+	out[6] = select16(_mm_and_si128(cond, eqDH), D, E);
+	out[7] = select16(_mm_and_si128(cond, _mm_or_si128(_mm_and_si128(eqDH, neEI), _mm_and_si128(eqHF, neEG))), H, E);
+	out[8] = select16(_mm_and_si128(cond, eqHF), F, E);
+	uint16_t tmp[9 * 8];
+	for (int i = 0; i < 9; ++i) {
+		_mm_storeu_si128((__m128i *)(tmp + i * 8), out[i]);
+	}
+	uint16_t *dst[3] = { dst0, dst1, dst2 };
+	for (int y = 0; y < 3; ++y) {
+		const uint16_t *p = tmp + y * 3 * 8;
+		for (int i = 0; i < 8; ++i) {
+			dst[y][i * 3]     = p[i];
+			dst[y][i * 3 + 1] = p[8 + i];
+			dst[y][i * 3 + 2] = p[16 + i];
+		}
+	}
+}
+
+#elif defined(SCALER_NEON)
+
+static void scanline2x_simd(uint16_t *dst0, uint16_t *dst1, const uint16_t *src0, const uint16_t *src1, const uint16_t *src2) {
+	const uint16x8_t B = vld1q_u16(src0);
+	const uint16x8_t D = vld1q_u16(src1 - 1);
+	const uint16x8_t E = vld1q_u16(src1);
+	const uint16x8_t F = vld1q_u16(src1 + 1);
+	const uint16x8_t H = vld1q_u16(src2);
+	const uint16x8_t cond = vandq_u16(vmvnq_u16(vceqq_u16(B, H)), vmvnq_u16(vceqq_u16(D, F)));
+	uint16x8x2_t out;
+	out.val[0] = vbslq_u16(vandq_u16(cond, vceqq_u16(D, B)), D, E);
+	out.val[1] = vbslq_u16(vandq_u16(cond, vceqq_u16(B, F)), F, E);
+	vst2q_u16(dst0, out);
+	out.val[0] = vbslq_u16(vandq_u16(cond, vceqq_u16(D, H)), D, E);
+	out.val[1] = vbslq_u16(vandq_u16(cond, vceqq_u16(H, F)), F, E);
+	vst2q_u16(dst1, out);
+}
+
+static void scanline3x_simd(uint16_t *dst0, uint16_t *dst1, uint16_t *dst2, const uint16_t *src0, const uint16_t *src1, const uint16_t *src2) {
+	const uint16x8_t A = vld1q_u16(src0 - 1);
+	const uint16x8_t B = vld1q_u16(src0);
+	const uint16x8_t C = vld1q_u16(src0 + 1);
+	const uint16x8_t D = vld1q_u16(src1 - 1);
+	const uint16x8_t E = vld1q_u16(src1);
+	const uint16x8_t F = vld1q_u16(src1 + 1);
+	const uint16x8_t G = vld1q_u16(src2 - 1);
+	const uint16x8_t H = vld1q_u16(src2);
+	const uint16x8_t I = vld1q_u16(src2 + 1);
+	const uint16x8_t cond = vandq_u16(vmvnq_u16(vceqq_u16(B, H)), vmvnq_u16(vceqq_u16(D, F)));
+	const uint16x8_t eqDB = vceqq_u16(D, B);
+	const uint16x8_t eqBF = vceqq_u16(B, F);
+	const uint16x8_t eqDH = vceqq_u16(D, H);
+	const uint16x8_t eqHF = vceqq_u16(H, F);
+	const uint16x8_t neEA = vmvnq_u16(vceqq_u16(E, A));
+	const uint16x8_t neEC = vmvnq_u16(vceqq_u16(E, C));
+	const uint16x8_t neEG = vmvnq_u16(vceqq_u16(E, G));
+	const uint16x8_t neEI = vmvnq_u16(vceqq_u16(E, I));
+	uint16x8x3_t out;
+	out.val[0] = vbslq_u16(vandq_u16(cond, eqDB), D, E);
+	out.val[1] = vbslq_u16(vandq_u16(cond, vorrq_u16(vandq_u16(vceqq_u16(E, B), neEC), vandq_u16(eqBF, neEA))), B, E);
+	out.val[2] = vbslq_u16(vandq_u16(cond, eqBF), F, E);
+	vst3q_u16(dst0, out);
+	out.val[0] = vbslq_u16(vandq_u16(cond, vandq_u16(eqDB, vorrq_u16(neEG, neEA))), D, E);
+	out.val[1] = E;
+	out.val[2] = vbslq_u16(vandq_u16(cond, vorrq_u16(vandq_u16(eqBF, neEI), vandq_u16(eqHF, neEC))), F, E);
+	vst3q_u16(dst1, out);
+	out.val[0] = vbslq_u16(vandq_u16(cond, eqDH), D, E);
+	out.val[1] = vbslq_u16(vandq_u16(cond, vorrq_u16(vandq_u16(eqDH, neEI), vandq_u16(eqHF, neEG))), H, E);
+	out.val[2] = vbslq_u16(vandq_u16(cond, eqHF), F, E);
+	vst3q_u16(dst2, out);
+}
+
+#endif
+
 static void scanline2x(uint16_t *dst0, uint16_t *dst1, const uint16_t *src0, const uint16_t *src1, const uint16_t *src2, int w) {
 	uint16_t B, D, E, F, H;
 
@@ -79,7 +219,21 @@ static void scanline2x(uint16_t *dst0, uint16_t *dst1, const uint16_t *src0, con
 
 	// center pixels
 	E = F;
-	for (x = 1; x < w - 1; ++x) {
+	x = 1;
+#if defined(SCALER_SSE2) || defined(SCALER_NEON)
+	if (x + 8 <= w - 1) {
+		do {
+			scanline2x_simd(dst0, dst1, src0 + x, src1 + x, src2 + x);
+			dst0 += 16;
+			dst1 += 16;
+			x += 8;
+		} while (x + 8 <= w - 1);
+		D = *(src1 + x - 1);
+		E = *(src1 + x);
+		F = E;
+	}
+#endif
+	for (; x < w - 1; ++x) {
 		B = *(src0 + x);
 		F = *(src1 + x + 1);
 		H = *(src2 + x);
@@ -198,7 +352,22 @@ static void scanline3x(uint16_t *dst0, uint16_t *dst1, uint16_t *dst2, const uin
 	B = C;
 	E = F;
 	H = I;
-	for (x = 1; x < w - 1; ++x) {
+	x = 1;
+#if defined(SCALER_SSE2) || defined(SCALER_NEON)
+	if (x + 8 <= w - 1) {
+		do {
+			scanline3x_simd(dst0, dst1, dst2, src0 + x, src1 + x, src2 + x);
+			dst0 += 24;
+			dst1 += 24;
+			dst2 += 24;
+			x += 8;
+		} while (x + 8 <= w - 1);
+		A = *(src0 + x - 1); B = *(src0 + x); C = B;
+		D = *(src1 + x - 1); E = *(src1 + x); F = E;
+		G = *(src2 + x - 1); H = *(src2 + x); I = H;
+	}
+#endif
+	for (; x < w - 1; ++x) {
 		C = *(src0 + x + 1);
 		F = *(src1 + x + 1);
 		I = *(src2 + x + 1);
@@ -290,3 +459,50 @@ void scale3x(uint16_t *dst, int dstPitch, const uint16_t *src, int srcPitch, int
 	src2 = src1;
 	scanline3x(dst, dst + dstPitch, dst + dstPitch2, src0, src1, src2, w);
 }
+
+static const struct {
+	void (*proc)(uint16_t *dst, int dstPitch, const uint16_t *src, int srcPitch, int w, int h);
+	const char *name;
+	int factor;
+} _benchScalers[] = {
+	{ point1x, "point1x", 1 },
+	{ point2x, "point2x", 2 },
+	{ scale2x, "scale2x", 2 },
+	{ point3x, "point3x", 3 },
+	{ scale3x, "scale3x", 3 },
+};
+
+void benchmarkScalers() {
+	static const int kW = 64;
+	static const int kH = 64;
+	static const int kIterations = 2000;
+	uint16_t *src = (uint16_t *)malloc(kW * kH * sizeof(uint16_t));
+	uint16_t *dst = (uint16_t *)malloc(kW * 3 * kH * 3 * sizeof(uint16_t));
+	if (!src || !dst) {
+		free(src);
+		free(dst);
+		return;
+	}
+	// wall like bitmap, horizontal runs of a few colors
+	uint32_t rnd = 0x1234;
+	for (int i = 0; i < kW * kH; ++i) {
+		if ((i & 3) == 0) {
+			rnd = rnd * 1103515245 + 12345;
+		}
+		src[i] = (rnd >> 16) & 7;
+	}
+	for (int i = 0; i < ARRAYSIZE(_benchScalers); ++i) {
+		const int factor = _benchScalers[i].factor;
+		struct timeval t0, t1;
+		gettimeofday(&t0, 0);
+		for (int n = 0; n < kIterations; ++n) {
+			_benchScalers[i].proc(dst, kW * factor, src, kW, kW, kH);
+		}
+		gettimeofday(&t1, 0);
+		const double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1000000.;
+		const double mpixels = kW * factor * kH * factor * (double)kIterations / 1000000.;
+		printf("%s: %.1f MPixel/s\n", _benchScalers[i].name, secs > 0. ? mpixels / secs : 0.);
+	}
+	free(src);
+	free(dst);
+}
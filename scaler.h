@@ -14,4 +14,6 @@ void point3x(uint16_t *dst, int dstPitch, const uint16_t *src, int srcPitch, int
 void scale2x(uint16_t *dst, int dstPitch, const uint16_t *src, int srcPitch, int w, int h);
 void scale3x(uint16_t *dst, int dstPitch, const uint16_t *src, int srcPitch, int w, int h);
 
+void benchmarkScalers();
+
 #endif // SCALER_H__
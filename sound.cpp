@@ -13,6 +13,9 @@ Sound::Sound(Resource *res)
 	_sfxPan = kDefaultPan;
 	_digiCount = 0;
 	_digiTable = 0;
+	_sfxCacheSize = 0;
+	_sfxCacheMaxSize = 32 << 20;
+	_sfxCacheHits = _sfxCacheMisses = 0;
 	_fpSnd = 0;
 	_midiCount = 0;
 	_midiTable = 0;
@@ -20,6 +23,12 @@ Sound::Sound(Resource *res)
 }
 
 Sound::~Sound() {
+	if (_digiTable) {
+		debug(kDebug_SOUND, "Sound::~Sound() sfx cache %d KB hits %d misses %d", _sfxCacheSize >> 10, _sfxCacheHits, _sfxCacheMisses);
+		for (int i = 0; i < _digiCount; ++i) {
+			free(_digiTable[i].samples);
+		}
+	}
 	free(_digiTable);
 	_digiTable = 0;
 	if (_fpSnd) {
@@ -148,6 +157,49 @@ const MidiSng *Sound::findMidiSngByName(const char *name) const {
 	return 0;
 }
 
+bool Sound::loadSfx(DigiSnd *dc) {
+	if (dc->samples) {
+		return true;
+	}
+	if (_sfxCacheSize + (int)dc->size * 2 > _sfxCacheMaxSize) {
+		return false;
+	}
+	fileSetPos(_fpSnd, dc->offset, kFilePosition_SET);
+	dc->samples = _mix.decodeWav(_fpSnd, dc->size, _digiCompressed, &dc->samplesCount);
+	if (!dc->samples) {
+		return false;
+	}
+	_sfxCacheSize += dc->samplesCount * sizeof(int16_t);
+	return true;
+}
+
+void Sound::preloadSfx() {
+	if (_sfxCacheMaxSize == 0 || !_fpSnd) {
+		return;
+	}
+	int count = 0;
+	const ResTreeNode *nodes = _res->_treesTable[kResType_SND];
+	for (int key = 1; key < _res->_treesTableCount[kResType_SND]; ++key) {
+		if (!nodes[key].data || nodes[key].dataSize == 0) {
+			continue;
+		}
+		const uint8_t *p_sndtype = _res->getData(kResType_SND, key, "SNDTYPE");
+		if (READ_LE_UINT32(p_sndtype) != 16) {
+			continue;
+		}
+		const uint8_t *p_sndinfo = _res->getData(kResType_SND, key, "SNDINFO");
+		DigiSnd *dc = (DigiSnd *)findDigiSndByName((const char *)p_sndinfo);
+		if (dc && !dc->samples) {
+			if (!loadSfx(dc)) {
+				warning("Sound::preloadSfx() sfx cache full (%d KB), not loading '%s'", _sfxCacheSize >> 10, dc->name);
+				break;
+			}
+			++count;
+		}
+	}
+	debug(kDebug_SOUND, "Sound::preloadSfx() loaded %d sounds, cache %d KB", count, _sfxCacheSize >> 10);
+}
+
 void Sound::setVolume(int volume) {
 	_sfxVolume = volume;
 }
@@ -175,8 +227,14 @@ void Sound::playSfx(int16_t objKey, int16_t sndKey, bool loop) {
 		const DigiSnd *dc = findDigiSndByName((const char *)p_sndinfo);
 		if (dc) {
 			debug(kDebug_SOUND, "Sound::playSfx() '%s' offset 0x%X", (const char *)p_sndinfo, dc->offset);
-			fileSetPos(_fpSnd, dc->offset, kFilePosition_SET);
-			_mix.playWav(_fpSnd, dc->size, _sfxVolume, _sfxPan, id, false, _digiCompressed);
+			if (dc->samples) {
+				++_sfxCacheHits;
+				_mix.playPcm(dc->samples, dc->samplesCount, _sfxVolume, _sfxPan, id);
+			} else {
+				++_sfxCacheMisses;
+				fileSetPos(_fpSnd, dc->offset, kFilePosition_SET);
+				_mix.playWav(_fpSnd, dc->size, _sfxVolume, _sfxPan, id, false, _digiCompressed);
+			}
 		}
 	}
 	_sfxVolume = kDefaultVolume;
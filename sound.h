@@ -16,6 +16,8 @@ struct DigiSnd {
 	char name[16];
 	uint32_t offset;
 	uint32_t size;
+	int16_t *samples; // decoded, kept until exit
+	int samplesCount;
 };
 
 struct MidiSng {
@@ -44,6 +46,9 @@ struct Sound {
 	void loadMidiSng(File *fp);
 	const MidiSng *findMidiSngByName(const char *name) const;
 
+	bool loadSfx(DigiSnd *dc);
+	void preloadSfx();
+
 	void setVolume(int volume);
 	void setPan(int pan);
 
@@ -68,6 +73,9 @@ struct Sound {
 	bool _digiCompressed;
 	int _digiCount;
 	DigiSnd *_digiTable;
+	int _sfxCacheSize;
+	int _sfxCacheMaxSize; // 0 to disable
+	int _sfxCacheHits, _sfxCacheMisses;
 	File *_fpSnd;
 	int _midiCount;
 	MidiSng *_midiTable;
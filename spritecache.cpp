@@ -5,9 +5,12 @@
 
 #include "decoder.h"
 #include "spritecache.h"
+#include "workerpool.h"
 
 SpriteCache::SpriteCache() {
 	memset(_entries, 0, sizeof(_entries));
+	_arena = 0;
+	memset(&_stats, 0, sizeof(_stats));
 }
 
 SpriteCache::~SpriteCache() {
@@ -15,33 +18,127 @@ SpriteCache::~SpriteCache() {
 }
 
 void SpriteCache::flush() {
+	if (_stats.preloaded != 0 || _stats.decodes != 0) {
+		debug(kDebug_RESOURCE, "SpriteCache::flush() decodes %d preloaded %d avoided %d arena %d", _stats.decodes, _stats.preloaded, _stats.preloadHits, _stats.arenaSize);
+	}
 	for (int i = 0; i < ARRAYSIZE(_entries); ++i) {
-		free(_entries[i].data);
+		if (!_entries[i].arena) {
+			free(_entries[i].data);
+		}
 	}
 	memset(_entries, 0, sizeof(_entries));
+	free(_arena);
+	_arena = 0;
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+static void decodeSprite(const uint8_t *src, uint8_t *dst) {
+	const int size = READ_LE_UINT16(src); src += 2;
+	const int packedSize = READ_LE_UINT16(src); src += 2;
+	if (size > packedSize) {
+		decodeLZSS(src, dst, size);
+	} else {
+		memcpy(dst, src, size);
+	}
 }
 
 uint8_t *SpriteCache::getData(int16_t key, const uint8_t *src) {
 	assert(key >= 0 && key < ARRAYSIZE(_entries));
 	if (_entries[key].data) {
 		if (src == _entries[key].src) {
+			if (!_entries[key].used) {
+				_entries[key].used = true;
+				if (_entries[key].arena) {
+					++_stats.preloadHits;
+				}
+			}
 			return _entries[key].data;
 		}
 		warning("Invalid cache entry for key %d", key);
-		free(_entries[key].data);
+		if (!_entries[key].arena) {
+			free(_entries[key].data);
+		}
 		_entries[key].data = 0;
+		_entries[key].arena = false;
 	}
-	const int size = READ_LE_UINT16(src); src += 2;
-	const int packedSize = READ_LE_UINT16(src); src += 2;
+	const int size = READ_LE_UINT16(src);
 	uint8_t *dst = (uint8_t *)malloc(size);
 	if (dst) {
-		if (size > packedSize) {
-			decodeLZSS(src, dst, size);
-		} else {
-			memcpy(dst, src, size);
-		}
-		_entries[key].src = src - 4;
+		decodeSprite(src, dst);
+		_entries[key].src = src;
 		_entries[key].data = dst;
+		_entries[key].pending = false;
+		_entries[key].used = true;
+		++_stats.decodes;
 	}
 	return dst;
 }
+
+void SpriteCache::queueSprite(int16_t key, const uint8_t *src) {
+	if (key >= 0 && key < ARRAYSIZE(_entries) && !_entries[key].data) {
+		_entries[key].src = src;
+		_entries[key].pending = true;
+	}
+}
+
+struct DecodeSpriteJob {
+	const uint8_t *src;
+	uint8_t *dst;
+};
+
+static void decodeSpriteJob(void *data, int index) {
+	DecodeSpriteJob *job = (DecodeSpriteJob *)data + index;
+	decodeSprite(job->src, job->dst);
+}
+
+void SpriteCache::preloadSprites() {
+	// the queued sprites are decoded in a single block, getData() then returns without decoding
+	int count = 0;
+	int arenaSize = 0;
+	for (int i = 0; i < ARRAYSIZE(_entries); ++i) {
+		if (_entries[i].pending) {
+			++count;
+			arenaSize += READ_LE_UINT16(_entries[i].src);
+		}
+	}
+	if (count == 0) {
+		return;
+	}
+	// a single arena per level, it is released by flush()
+	if (_arena) {
+		// the queued sprites are decoded by getData() when first drawn
+		debug(kDebug_RESOURCE, "SpriteCache::preloadSprites() arena already allocated, %d sprites left queued", count);
+		return;
+	}
+	_arena = (uint8_t *)malloc(arenaSize);
+	DecodeSpriteJob *jobs = (DecodeSpriteJob *)malloc(count * sizeof(DecodeSpriteJob));
+	if (!_arena || !jobs) {
+		warning("SpriteCache::preloadSprites() unable to preload %d sprites", count);
+		free(_arena);
+		_arena = 0;
+		free(jobs);
+		for (int i = 0; i < ARRAYSIZE(_entries); ++i) {
+			_entries[i].pending = false;
+		}
+		return;
+	}
+	int offset = 0;
+	count = 0;
+	for (int i = 0; i < ARRAYSIZE(_entries); ++i) {
+		if (_entries[i].pending) {
+			_entries[i].pending = false;
+			_entries[i].data = _arena + offset;
+			_entries[i].arena = true;
+			_entries[i].used = false;
+			jobs[count].src = _entries[i].src;
+			jobs[count].dst = _entries[i].data;
+			++count;
+			offset += READ_LE_UINT16(_entries[i].src);
+		}
+	}
+	g_workerPool.run(decodeSpriteJob, jobs, count);
+	free(jobs);
+	_stats.preloaded = count;
+	_stats.arenaSize = arenaSize;
+	debug(kDebug_RESOURCE, "SpriteCache::preloadSprites() %d sprites %d bytes", count, arenaSize);
+}
@@ -6,11 +6,23 @@
 #ifndef SPRITECACHE_H__
 #define SPRITECACHE_H__
 
+struct SpriteCacheStats {
+	int decodes; // sprites decoded when first drawn
+	int preloaded;
+	int preloadHits; // decodes avoided by preloading
+	int arenaSize;
+};
+
 struct SpriteCache {
 	struct {
 		const uint8_t *src;
 		uint8_t *data;
+		bool arena; // data points to _arena
+		bool pending; // queued for preloadSprites()
+		bool used;
 	} _entries[3072];
+	uint8_t *_arena;
+	SpriteCacheStats _stats;
 
 	SpriteCache();
 	~SpriteCache();
@@ -18,6 +30,8 @@ struct SpriteCache {
 	void flush();
 
 	uint8_t *getData(int16_t key, const uint8_t *src);
+	void queueSprite(int16_t key, const uint8_t *src);
+	void preloadSprites();
 };
 
 #endif // SPRITECACHE_H__
@@ -9,7 +9,10 @@
 #include "mixer.h"
 #include "sound.h"
 #include "render.h"
+#include "scaler.h"
 #include "stub.h"
+#include "trace.h"
+#include "workerpool.h"
 
 static const char *USAGE =
 	"Fade2Black/OpenGL\n"
@@ -26,9 +29,21 @@ static const char *USAGE =
 	"  --soundfont=FILE            SoundFont (.sf2) file for music\n"
 	"  --texturefilter=FILTER      Texture filter (default 'linear')\n"
 	"  --texturescaler=NAME        Texture scaler (default 'scale2x')\n"
+	"  --texturecache=MB           Texture cache size in MB (default 64, 0 for unlimited)\n"
 	"  --mouse                     Enable mouse controls\n"
 	"  --no-fog                    Disable fog rendering\n"
 	"  --no-gouraud                Disable gouraud shading\n"
+	"  --no-batching               Draw polygons immediately (no vertex arrays)\n"
+	"  --gpu-palette               Use a shader for palette lookups\n"
+	"  --fileindexcache            Cache the data files index in the save path\n"
+	"  --preload-sprites           Decode the level sprites when loading\n"
+	"  --benchmark                 Replay the level demo without display and print timings\n"
+	"  --sfxcache=MB               Decoded sound effects cache size in MB (default 32, 0 to disable)\n"
+	"  --cutscene-decode-ahead=N   Cutscene frames decoded in advance (default 4, 0 to disable)\n"
+	"  --trace=FILE                Write a Chrome trace (JSON) of the engine timings to FILE\n"
+	"  --interpolate               Draw at the display rate, interpolating between game ticks\n"
+	"  --max-particles=N           Maximum number of particles (default 256)\n"
+	"  --no-visibility-cache       Raycast the scene on every frame\n"
 	"  --psxpath=PATH              Path to PSX data files\n"
 ;
 
@@ -107,16 +122,22 @@ struct GameStub_F2B : GameStub {
 	RenderParams _renderParams;
 	char *_textureFilter;
 	char *_textureScaler;
+	bool _fileIndexCache;
+	bool _benchmark;
+	TickStats _tickStats;
 
 	GameStub_F2B()
 		: _render(0), _g(0),
 		_fileLanguage(kFileLanguage_EN), _fileVoice(kFileLanguage_EN), _displayMode(kDisplayModeWindow) {
-		memset(&_params, 0, sizeof(_params));
 		_params.cheats = kCheatAutoReloadGun | kCheatActivateButtonToShoot | kCheatStepWithUpDownInShooting;
 		_soundFont = 0;
+		_fileIndexCache = false;
+		_benchmark = false;
 		memset(&_renderParams, 0, sizeof(_renderParams));
 		_renderParams.fog = true;
 		_renderParams.gouraud = true;
+		_renderParams.textureCacheSize = 64;
+		_renderParams.batching = true;
 		_textureFilter = 0;
 		_textureScaler = 0;
 		_fov = 0;
@@ -196,8 +217,23 @@ struct GameStub_F2B : GameStub {
 				{ "no-gouraud",    no_argument,       0, 18 },
 				{ "psxpath",       required_argument, 0, 19 },
 				{ "cheats",        required_argument, 0, 20 },
+				{ "texturecache",  required_argument, 0, 21 },
+				{ "no-batching",   no_argument,       0, 22 },
+				{ "gpu-palette",   no_argument,       0, 23 },
+				{ "fileindexcache", no_argument,      0, 24 },
+				{ "preload-sprites", no_argument,     0, 25 },
+				{ "benchmark",     no_argument,       0, 26 },
+				{ "sfxcache",      required_argument, 0, 27 },
+				{ "cutscene-decode-ahead", required_argument, 0, 28 },
+				{ "trace",         required_argument, 0, 29 },
+				{ "interpolate",   no_argument,       0, 30 },
+				{ "max-particles", required_argument, 0, 31 },
+				{ "no-visibility-cache", no_argument, 0, 32 },
 				// debug
 				{ "init-state",    required_argument, 0, 101 },
+				{ "bench-scalers", no_argument,       0, 102 },
+				{ "bench-mdec",    required_argument, 0, 103 },
+				{ "bench-mixer",   no_argument,       0, 104 },
 				{ 0, 0, 0, 0 }
 			};
 			int index;
@@ -278,6 +314,44 @@ struct GameStub_F2B : GameStub {
 			case 20:
 				_params.cheats = atoi(optarg);
 				break;
+			case 21:
+				_renderParams.textureCacheSize = MAX(0, atoi(optarg));
+				break;
+			case 22:
+				_renderParams.batching = false;
+				break;
+			case 23:
+				_renderParams.gpuPalette = true;
+				break;
+			case 24:
+				_fileIndexCache = true;
+				break;
+			case 25:
+				_params.preloadSprites = true;
+				break;
+			case 26:
+				_benchmark = true;
+				_params.playDemo = true;
+				_nextState = kStateGame;
+				break;
+			case 27:
+				_params.sfxCacheSize = MAX(0, atoi(optarg));
+				break;
+			case 28:
+				_params.cutsceneDecodeAhead = MAX(0, atoi(optarg));
+				break;
+			case 29:
+				traceInit(optarg);
+				break;
+			case 30:
+				_renderParams.interpolation = true;
+				break;
+			case 31:
+				_params.particlesMax = MAX(1, atoi(optarg));
+				break;
+			case 32:
+				_params.sceneVisibilityCache = false;
+				break;
 			case 101: {
 					static struct {
 						const char *name;
@@ -296,6 +370,18 @@ struct GameStub_F2B : GameStub {
 					}
 				}
 				break;
+			case 102:
+				benchmarkScalers();
+				exit(0);
+				break;
+			case 103:
+				benchmarkMdec(optarg);
+				exit(0);
+				break;
+			case 104:
+				benchmarkMixer();
+				exit(0);
+				break;
 			default:
 				printf("%s\n", USAGE);
 				return -1;
@@ -319,7 +405,7 @@ struct GameStub_F2B : GameStub {
 		return _params.mouseMode || _params.touchMode;
 	}
 	virtual int init() {
-		if (!fileInit(_fileLanguage, _fileVoice, _dataPath ? _dataPath : ".", _savePath ? _savePath : ".")) {
+		if (!fileInit(_fileLanguage, _fileVoice, _dataPath ? _dataPath : ".", _savePath ? _savePath : ".", _fileIndexCache)) {
 			warning("Unable to find PC datafiles");
 			return -2;
 		}
@@ -329,8 +415,16 @@ struct GameStub_F2B : GameStub {
 				// PSX data is optional
 			}
 		}
+		g_workerPool.init();
+		if (_benchmark) {
+			// no display, the ticks are drawn as they run
+			_renderParams.interpolation = false;
+		}
 		_render = new Render(&_renderParams);
 		_g = new Game(_render, &_params);
+		if (_benchmark) {
+			_g->_tickStats = &_tickStats;
+		}
 		_g->init();
 		_g->_cut._numToPlay = 47;
 		_state = -1;
@@ -343,10 +437,18 @@ struct GameStub_F2B : GameStub {
 		return 0;
 	}
 	virtual void quit() {
+		if (_benchmark) {
+			_tickStats.dumpJson(stdout);
+		}
 		delete _g;
 		_g = 0;
 		delete _render;
 		_render = 0;
+		g_workerPool.fini();
+		if (!fileWaitPendingWrites()) {
+			warning("Failed to write the last savegame");
+		}
+		traceFini();
 		free(_dataPath);
 		_dataPath = 0;
 		free(_savePath);
@@ -456,6 +558,8 @@ struct GameStub_F2B : GameStub {
 		}
 	}
 	virtual void doTick(unsigned int ticks) {
+		TraceZone zone("GameStub_F2B::doTick");
+		_render->beginFrame();
 		if (_nextState != _state) {
 			setState(_nextState);
 		}
@@ -489,7 +593,16 @@ struct GameStub_F2B : GameStub {
 				}
 			}
 			_g->updateGameInput();
-			_g->doTick();
+			if (_benchmark) {
+				_tickStats.beginTick();
+				{
+					TickPhase phase(&_tickStats, kTickPhase_Total);
+					_g->doTick();
+				}
+				_tickStats.endTick();
+			} else {
+				_g->doTick();
+			}
 			if (_g->inp.inventoryKey) {
 				_g->inp.inventoryKey = false;
 				_nextState = kStateInventory;
@@ -539,7 +652,8 @@ struct GameStub_F2B : GameStub {
 	virtual void initGL(int w, int h, float *ar) {
 		_render->resizeScreen(w, h, ar, _fov);
 	}
-	virtual void drawGL() {
+	virtual void drawGL(int alpha) {
+		_render->replayFrame(alpha);
 		_render->drawOverlay();
 		if (_loadState) {
 			if (_state == kStateGame) {
@@ -581,6 +695,16 @@ struct GameStub_F2B : GameStub {
 	virtual bool shouldVibrate() {
 		return _g->_conradHit == 2;
 	}
+	virtual bool isBenchmark() {
+		return _benchmark;
+	}
+	virtual bool hasInterpolation() {
+		return _renderParams.interpolation;
+	}
+	virtual bool isBenchmarkDone() {
+		// the replay ends with the demo inputs or the level
+		return _state == kStateGame && (_g->_demoInput >= _g->_res._demoInputDataSize || _g->_changeLevel || _g->_endGame);
+	}
 };
 
 extern "C" {
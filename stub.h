@@ -56,11 +56,14 @@ struct GameStub {
 	virtual void queueTouchInput(int pointer, int x, int y, int down) = 0;
 	virtual void doTick(unsigned int ticks) = 0;
 	virtual void initGL(int w, int h, float *ar) = 0;
-	virtual void drawGL() = 0;
+	virtual void drawGL(int alpha) = 0; // alpha is the elapsed fraction (0..256) of the current game tick
 	virtual void loadState(int slot) = 0;
 	virtual void saveState(int slot) = 0;
 	virtual void takeScreenshot() = 0;
 	virtual bool shouldVibrate() = 0;
+	virtual bool isBenchmark() = 0;
+	virtual bool isBenchmarkDone() = 0;
+	virtual bool hasInterpolation() = 0;
 };
 
 extern "C" {
@@ -6,12 +6,16 @@
 #ifdef USE_GLES
 #include <GLES/gl.h>
 #else
+#include <SDL.h>
 #include <SDL_opengl.h>
 #endif
 #include "scaler.h"
 #include "texturecache.h"
+#include "trace.h"
+#include "workerpool.h"
 
 static const int kLutTextureBufferSize = 320 * 200;
+static const int kConvertJobsCount = 64;
 
 static uint16_t convert_RGBA_5551(int r, int g, int b) {
 	return ((r >> 3) << 11) | ((g >> 3) << 6) | ((b >> 3) << 1) | 1;
@@ -27,6 +31,8 @@ static const struct {
 	{ GL_RGBA, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, &convert_RGBA_5551 },
 #else
 	{ GL_RGB5_A1, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, &convert_RGBA_5551 },
+	// palette indexes are stored as (index * 257), normalized to index / 255 when uploaded
+	{ GL_LUMINANCE8, GL_LUMINANCE, GL_UNSIGNED_SHORT, 0 },
 #endif
 	{ -1, -1, -1, 0 }
 };
@@ -54,10 +60,86 @@ static const struct {
 };
 
 static const int _fmt = 0;
+static const int _fmtIndex = 1;
+
+static int textureFormat(const Texture *t) {
+	return t->indexed ? _fmtIndex : _fmt;
+}
+
+#ifndef USE_GLES
+static const char *_paletteFragmentShader =
+	"uniform sampler2D indexTex;\n"
+	"uniform sampler2D lutTex;\n"
+	"uniform vec2 texSize;\n"
+	"uniform bool linearFilter;\n"
+	"uniform bool fog;\n"
+	"vec4 lookup(vec2 uv) {\n"
+	"	float index = texture2D(indexTex, uv).r;\n"
+	"	return texture2D(lutTex, vec2((index * 255. + .5) / 256., .5));\n"
+	"}\n"
+	"void main() {\n"
+	"	vec4 color;\n"
+	"	if (linearFilter) {\n"
+	"		vec2 st = gl_TexCoord[0].xy * texSize - .5;\n"
+	"		vec2 f = fract(st);\n"
+	"		vec2 uv = (floor(st) + .5) / texSize;\n"
+	"		vec2 d = 1. / texSize;\n"
+	"		vec4 c0 = mix(lookup(uv), lookup(uv + vec2(d.x, 0.)), f.x);\n"
+	"		vec4 c1 = mix(lookup(uv + vec2(0., d.y)), lookup(uv + d), f.x);\n"
+	"		color = mix(c0, c1, f.y);\n"
+	"	} else {\n"
+	"		color = lookup(gl_TexCoord[0].xy);\n"
+	"	}\n"
+	"	color *= gl_Color;\n"
+	"	if (fog) {\n"
+	"		float f = clamp((gl_Fog.end - gl_FogFragCoord) * gl_Fog.scale, 0., 1.);\n"
+	"		color.rgb = mix(gl_Fog.color.rgb, color.rgb, f);\n"
+	"	}\n"
+	"	gl_FragColor = color;\n"
+	"}\n";
+
+static PFNGLACTIVETEXTUREPROC _glActiveTexture;
+static PFNGLCREATESHADERPROC _glCreateShader;
+static PFNGLSHADERSOURCEPROC _glShaderSource;
+static PFNGLCOMPILESHADERPROC _glCompileShader;
+static PFNGLGETSHADERIVPROC _glGetShaderiv;
+static PFNGLDELETESHADERPROC _glDeleteShader;
+static PFNGLCREATEPROGRAMPROC _glCreateProgram;
+static PFNGLATTACHSHADERPROC _glAttachShader;
+static PFNGLLINKPROGRAMPROC _glLinkProgram;
+static PFNGLGETPROGRAMIVPROC _glGetProgramiv;
+static PFNGLUSEPROGRAMPROC _glUseProgram;
+static PFNGLGETUNIFORMLOCATIONPROC _glGetUniformLocation;
+static PFNGLUNIFORM1IPROC _glUniform1i;
+static PFNGLUNIFORM2FPROC _glUniform2f;
+
+template<typename T>
+static bool getProcAddress(T *proc, const char *name) {
+	*proc = (T)SDL_GL_GetProcAddress(name);
+	return *proc != 0;
+}
+#endif
+
+static int hashKey(int16_t key) {
+	return ((uint16_t)key) & (kTextureHashSize - 1);
+}
 
 TextureCache::TextureCache()
 	: _texturesListHead(0), _texturesListTail(0) {
+	memset(_texturesHash, 0, sizeof(_texturesHash));
 	memset(_clut, 0, sizeof(_clut));
+	for (int i = 0; i < 256; ++i) {
+		_indexClut[i] = i * 257;
+	}
+	_gpuPalette = false;
+	_lutTex = 0;
+	_paletteProgram = 0;
+	_texSizeLoc = _linearFilterLoc = _fogLoc = -1;
+	memset(&_stats, 0, sizeof(_stats));
+	_memSizeMax = 0;
+	_deferEviction = false;
+	_atlasPending = 0;
+	_atlasPendingCount = _atlasPendingSize = 0;
 	_texBuf = 0;
 	_npotTex = false;
 	_filter = GL_LINEAR;
@@ -66,6 +148,7 @@ TextureCache::TextureCache()
 
 TextureCache::~TextureCache() {
 	free(_texBuf);
+	free(_atlasPending);
 	flush();
 }
 
@@ -78,7 +161,8 @@ static bool hasExt(const char *exts, const char *name) {
 	return false;
 }
 
-void TextureCache::init(const char *filter, const char *scaler) {
+void TextureCache::init(const char *filter, const char *scaler, int memSizeMax, bool gpuPalette) {
+	_memSizeMax = memSizeMax;
 	const char *exts = (const char *)glGetString(GL_EXTENSIONS);
 	if (exts && hasExt(exts, "GL_ARB_texture_non_power_of_two")) {
 		_npotTex = true;
@@ -102,63 +186,189 @@ void TextureCache::init(const char *filter, const char *scaler) {
 	if (_scalers[_scaler].factor != 1) {
 		_texBuf = (uint16_t *)malloc(kLutTextureBufferSize * sizeof(uint16_t));
 	}
+	if (gpuPalette) {
+		_gpuPalette = initPaletteShader();
+		if (!_gpuPalette) {
+			warning("Palette shader not available, using CPU palette conversion");
+		}
+	}
+}
+
+bool TextureCache::initPaletteShader() {
+#ifdef USE_GLES
+	return false;
+#else
+	if (!getProcAddress(&_glActiveTexture, "glActiveTexture") ||
+		!getProcAddress(&_glCreateShader, "glCreateShader") ||
+		!getProcAddress(&_glShaderSource, "glShaderSource") ||
+		!getProcAddress(&_glCompileShader, "glCompileShader") ||
+		!getProcAddress(&_glGetShaderiv, "glGetShaderiv") ||
+		!getProcAddress(&_glDeleteShader, "glDeleteShader") ||
+		!getProcAddress(&_glCreateProgram, "glCreateProgram") ||
+		!getProcAddress(&_glAttachShader, "glAttachShader") ||
+		!getProcAddress(&_glLinkProgram, "glLinkProgram") ||
+		!getProcAddress(&_glGetProgramiv, "glGetProgramiv") ||
+		!getProcAddress(&_glUseProgram, "glUseProgram") ||
+		!getProcAddress(&_glGetUniformLocation, "glGetUniformLocation") ||
+		!getProcAddress(&_glUniform1i, "glUniform1i") ||
+		!getProcAddress(&_glUniform2f, "glUniform2f")) {
+		warning("TextureCache::initPaletteShader() GL 2.0 entry points not found");
+		return false;
+	}
+	GLint status = 0;
+	const GLuint shader = _glCreateShader(GL_FRAGMENT_SHADER);
+	_glShaderSource(shader, 1, &_paletteFragmentShader, 0);
+	_glCompileShader(shader);
+	_glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		warning("TextureCache::initPaletteShader() failed to compile shader");
+		_glDeleteShader(shader);
+		return false;
+	}
+	_paletteProgram = _glCreateProgram();
+	_glAttachShader(_paletteProgram, shader);
+	_glLinkProgram(_paletteProgram);
+	_glDeleteShader(shader);
+	_glGetProgramiv(_paletteProgram, GL_LINK_STATUS, &status);
+	if (!status) {
+		warning("TextureCache::initPaletteShader() failed to link program");
+		return false;
+	}
+	_glUseProgram(_paletteProgram);
+	_glUniform1i(_glGetUniformLocation(_paletteProgram, "indexTex"), 0);
+	_glUniform1i(_glGetUniformLocation(_paletteProgram, "lutTex"), 1);
+	_texSizeLoc = _glGetUniformLocation(_paletteProgram, "texSize");
+	_linearFilterLoc = _glGetUniformLocation(_paletteProgram, "linearFilter");
+	_fogLoc = _glGetUniformLocation(_paletteProgram, "fog");
+	_glUniform1i(_linearFilterLoc, _filter == GL_LINEAR);
+	_glUseProgram(0);
+	// the lookup texture stays bound to the second texture unit
+	glGenTextures(1, &_lutTex);
+	_glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, _lutTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	_glActiveTexture(GL_TEXTURE0);
+	return true;
+#endif
 }
 
 void TextureCache::flush() {
 	Texture *t = _texturesListHead;
 	while (t) {
 		Texture *next = t->next;
-		glDeleteTextures(1, &t->id);
+		if (!t->atlas) {
+			glDeleteTextures(1, &t->id);
+		}
 		free(t->bitmapData);
 		delete t;
 		t = next;
 	}
 	_texturesListHead = _texturesListTail = 0;
+	memset(_texturesHash, 0, sizeof(_texturesHash));
+	_atlasPendingCount = 0;
+	_stats.texturesCount = 0;
+	_stats.memSize = 0;
 	memset(_clut, 0, sizeof(_clut));
 }
 
-bool TextureCache::hasTexture(int16_t key) const {
-	for (Texture *t = _texturesListHead; t; t = t->next) {
+Texture *TextureCache::findTexture(int16_t key) const {
+	for (Texture *t = _texturesHash[hashKey(key)]; t; t = t->hashNext) {
 		if (t->key == key) {
-			return true;
+			return t;
 		}
 	}
-	return false;
+	return 0;
+}
+
+bool TextureCache::hasTexture(int16_t key) const {
+	return findTexture(key) != 0;
 }
 
 void TextureCache::releaseTexture(int16_t key) {
-	for (Texture *t = _texturesListHead; t; t = t->next) {
-		if (t->key == key) {
-			destroyTexture(t);
-			break;
-		}
+	Texture *t = findTexture(key);
+	if (t) {
+		destroyTexture(t);
+	}
+}
+
+void TextureCache::pinTexture(int16_t key) {
+	// texture data is not provided when drawn, it cannot be evicted
+	Texture *t = findTexture(key);
+	if (t) {
+		t->pinned = true;
+	}
+}
+
+static void unlinkTexture(Texture *t, Texture **head, Texture **tail) {
+	if (t->prev) {
+		t->prev->next = t->next;
+	} else {
+		*head = t->next;
+	}
+	if (t->next) {
+		t->next->prev = t->prev;
+	} else {
+		*tail = t->prev;
+	}
+	t->prev = t->next = 0;
+}
+
+static void linkTextureHead(Texture *t, Texture **head, Texture **tail) {
+	t->prev = 0;
+	t->next = *head;
+	if (*head) {
+		(*head)->prev = t;
+	} else {
+		*tail = t;
 	}
+	*head = t;
 }
 
 Texture *TextureCache::getCachedTexture(int16_t key, const uint8_t *data, int w, int h, bool rgb, const uint8_t *pal) {
-	Texture *prev = 0;
-	for (Texture *t = _texturesListHead; t; t = t->next) {
-		if (t->key == key) {
-			if (prev) { // move to head
-				prev->next = t->next;
-				t->next = _texturesListHead;
-				_texturesListHead = t;
-				if (t == _texturesListTail) {
-					_texturesListTail = prev;
-				}
-			}
-			return t;
+	Texture *t = findTexture(key);
+	if (t) {
+		++_stats.hits;
+		if (t != _texturesListHead) {
+			unlinkTexture(t, &_texturesListHead, &_texturesListTail);
+			linkTextureHead(t, &_texturesListHead, &_texturesListTail);
 		}
-		prev = t;
+		return t;
 	}
+	++_stats.misses;
 	assert(data && w > 0 && h > 0);
-	Texture *t = createTexture(data, w, h, rgb, pal);
+	t = createTexture(data, w, h, rgb, pal);
 	if (t) {
 		t->key = key;
+		const int index = hashKey(key);
+		t->hashNext = _texturesHash[index];
+		_texturesHash[index] = t;
+		if (!_deferEviction) {
+			evictTextures(t);
+		}
 	}
 	return t;
 }
 
+void TextureCache::evictTextures(const Texture *keep) {
+	if (_memSizeMax <= 0 || _stats.memSize <= _memSizeMax) {
+		return;
+	}
+	Texture *t = _texturesListTail;
+	while (t && _stats.memSize > _memSizeMax) {
+		Texture *prev = t->prev;
+		// textures without a key are owned by the caller (overlay)
+		if (t != keep && t->key != -1 && !t->pinned) {
+			++_stats.evictions;
+			destroyTexture(t);
+		}
+		t = prev;
+	}
+}
+
 static int roundPow2(int sz) {
 	if (sz != 0 && (sz & (sz - 1)) == 0) {
 		return sz;
@@ -170,8 +380,8 @@ static int roundPow2(int sz) {
 	return textureSize;
 }
 
-void TextureCache::convertTexture(const uint8_t *src, int w, int h, const uint16_t *clut, uint16_t *dst, int dstPitch) {
-	if (_scalers[_scaler].factor == 1) {
+static void convertBitmap(int scaler, const uint8_t *src, int w, int h, const uint16_t *clut, uint16_t *dst, int dstPitch, uint16_t *tmp) {
+	if (_scalers[scaler].factor == 1) {
 		for (int y = 0; y < h; ++y) {
 			for (int x = 0; x < w; ++x) {
 				dst[x] = clut[*src++];
@@ -179,19 +389,90 @@ void TextureCache::convertTexture(const uint8_t *src, int w, int h, const uint16
 			dst += dstPitch;
 		}
 	} else {
-		assert(w * h <= kLutTextureBufferSize);
 		int offset = 0;
 		for (int y = 0; y < h; ++y) {
 			for (int x = 0; x < w; ++x) {
-				_texBuf[offset + x] = clut[*src++];
+				tmp[offset + x] = clut[*src++];
 			}
 			offset += w;
 		}
-		_scalers[_scaler].proc(dst, dstPitch, _texBuf, w, w, h);
+		_scalers[scaler].proc(dst, dstPitch, tmp, w, w, h);
+	}
+}
+
+void TextureCache::convertTexture(const uint8_t *src, int w, int h, const uint16_t *clut, uint16_t *dst, int dstPitch) {
+	assert(w * h <= kLutTextureBufferSize);
+	convertBitmap(_scaler, src, w, h, clut, dst, dstPitch, _texBuf);
+}
+
+struct ConvertJob {
+	const Texture *t;
+	const uint16_t *clut;
+	int scaler;
+	uint16_t *texData;
+};
+
+static void convertTextureJob(void *data, int index) {
+	ConvertJob *job = (ConvertJob *)data + index;
+	const Texture *t = job->t;
+	// atlas textures have a one pixel border, the others are padded to the texture size
+	const int w = t->atlas ? t->texW + 2 : t->texW;
+	const int h = t->atlas ? t->texH + 2 : t->texH;
+	// the scaler input is stored after the texture pixels
+	job->texData = (uint16_t *)calloc(w * h + t->bitmapW * t->bitmapH, sizeof(uint16_t));
+	if (!job->texData) {
+		return;
+	}
+	uint16_t *tmp = job->texData + w * h;
+	if (t->atlas) {
+		uint16_t *texData = job->texData;
+		convertBitmap(job->scaler, t->bitmapData, t->bitmapW, t->bitmapH, job->clut, texData + w + 1, w, tmp);
+		for (int y = 1; y < h - 1; ++y) {
+			uint16_t *p = texData + y * w;
+			p[0] = p[1];
+			p[w - 1] = p[w - 2];
+		}
+		memcpy(texData, texData + w, w * sizeof(uint16_t));
+		memcpy(texData + (h - 1) * w, texData + (h - 2) * w, w * sizeof(uint16_t));
+	} else {
+		convertBitmap(job->scaler, t->bitmapData, t->bitmapW, t->bitmapH, job->clut, job->texData, w, tmp);
+	}
+}
+
+void TextureCache::convertTextures(Texture **textures, int count) {
+	TraceZone zone("TextureCache::convertTextures");
+	// bitmaps are converted and scaled on the worker threads, uploads are done on the calling (GL) thread
+	ConvertJob jobs[kConvertJobsCount];
+	for (int first = 0; first < count; first += kConvertJobsCount) {
+		const int jobsCount = MIN(count - first, kConvertJobsCount);
+		for (int i = 0; i < jobsCount; ++i) {
+			Texture *t = textures[first + i];
+			jobs[i].t = t;
+			jobs[i].clut = t->indexed ? _indexClut : _clut;
+			jobs[i].scaler = _scaler;
+			jobs[i].texData = 0;
+		}
+		g_workerPool.run(convertTextureJob, jobs, jobsCount);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int i = 0; i < jobsCount; ++i) {
+			const Texture *t = jobs[i].t;
+			if (!jobs[i].texData) {
+				continue;
+			}
+			const int fmt = textureFormat(t);
+			glBindTexture(GL_TEXTURE_2D, t->id);
+			if (t->atlas) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, t->atlasX, t->atlasY, t->texW + 2, t->texH + 2, _formats[fmt].format, _formats[fmt].type, jobs[i].texData);
+			} else {
+				glTexImage2D(GL_TEXTURE_2D, 0, _formats[fmt].internal, t->texW, t->texH, 0, _formats[fmt].format, _formats[fmt].type, jobs[i].texData);
+			}
+			free(jobs[i].texData);
+		}
 	}
 }
 
 Texture *TextureCache::createTexture(const uint8_t *data, int w, int h, bool rgb, const uint8_t *pal) {
+	TraceZone zone("TextureCache::createTexture");
 	Texture *t = new Texture;
 	t->bitmapW = w;
 	t->bitmapH = h;
@@ -212,6 +493,11 @@ Texture *TextureCache::createTexture(const uint8_t *data, int w, int h, bool rgb
 	t->texH = _npotTex ? h : roundPow2(h);
 	t->u = w / (float)t->texW;
 	t->v = h / (float)t->texH;
+	t->u0 = t->v0 = 0.;
+	t->atlas = 0;
+	t->indexed = _gpuPalette && !rgb && !pal;
+	const int fmt = textureFormat(t);
+	const int filter = t->indexed ? GL_NEAREST : _filter;
 	glGenTextures(1, &t->id);
 	uint16_t *texData = (uint16_t *)calloc(t->texW * t->texH, sizeof(uint16_t));
 	if (texData) {
@@ -228,53 +514,50 @@ Texture *TextureCache::createTexture(const uint8_t *data, int w, int h, bool rgb
 			convertPalette(pal, clut);
 			convertTexture(t->bitmapData, t->bitmapW, t->bitmapH, clut, texData, t->texW);
 		} else {
-			convertTexture(t->bitmapData, t->bitmapW, t->bitmapH, _clut, texData, t->texW);
+			convertTexture(t->bitmapData, t->bitmapW, t->bitmapH, t->indexed ? _indexClut : _clut, texData, t->texW);
 		}
 		glBindTexture(GL_TEXTURE_2D, t->id);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, _filter);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, _filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
 		if (_filter == GL_LINEAR) {
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		}
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-		glTexImage2D(GL_TEXTURE_2D, 0, _formats[_fmt].internal, t->texW, t->texH, 0, _formats[_fmt].format, _formats[_fmt].type, texData);
+		glTexImage2D(GL_TEXTURE_2D, 0, _formats[fmt].internal, t->texW, t->texH, 0, _formats[fmt].format, _formats[fmt].type, texData);
 		free(texData);
 	}
-	if (!_texturesListHead) {
-		_texturesListHead = _texturesListTail = t;
-	} else {
-		_texturesListTail->next = t;
-		_texturesListTail = t;
-	}
-	t->next = 0;
+	linkTextureHead(t, &_texturesListHead, &_texturesListTail);
+	t->hashNext = 0;
 	t->key = -1;
+	t->pinned = false;
+	t->memSize = t->texW * t->texH * (t->indexed ? 1 : 2);
+	++_stats.texturesCount;
+	_stats.memSize += t->memSize;
 	return t;
 }
 
 void TextureCache::destroyTexture(Texture *texture) {
-	glDeleteTextures(1, &texture->id);
+	if (!texture->atlas) {
+		glDeleteTextures(1, &texture->id);
+	}
 	free(texture->bitmapData);
-	if (texture == _texturesListHead) {
-		_texturesListHead = texture->next;
-		if (texture == _texturesListTail) {
-			_texturesListTail = _texturesListHead;
-		}
-	} else {
-		for (Texture *t = _texturesListHead; t; t = t->next) {
-			if (t->next == texture) {
-				t->next = texture->next;
-				if (texture == _texturesListTail) {
-					_texturesListTail = t;
-				}
+	if (texture->key != -1) {
+		for (Texture **p = &_texturesHash[hashKey(texture->key)]; *p; p = &(*p)->hashNext) {
+			if (*p == texture) {
+				*p = texture->hashNext;
 				break;
 			}
 		}
 	}
+	unlinkTexture(texture, &_texturesListHead, &_texturesListTail);
+	--_stats.texturesCount;
+	_stats.memSize -= texture->memSize;
 	delete texture;
 }
 
 void TextureCache::updateTexture(Texture *t, const uint8_t *data, int w, int h, bool rgb, const uint8_t *pal) {
+	TraceZone zone("TextureCache::updateTexture");
 	assert(t->bitmapW == w && t->bitmapH == h);
 	if (rgb) {
 		assert(t->bitmapData == 0);
@@ -291,14 +574,17 @@ void TextureCache::updateTexture(Texture *t, const uint8_t *data, int w, int h,
 				}
 				p += t->texW;
 			}
+		} else if (t->indexed) {
+			convertTexture(t->bitmapData, t->bitmapW, t->bitmapH, _indexClut, texData, t->texW);
 		} else {
 			assert(pal);
 			uint16_t clut[256];
 			convertPalette(pal, clut);
 			convertTexture(t->bitmapData, t->bitmapW, t->bitmapH, clut, texData, t->texW);
 		}
+		const int fmt = textureFormat(t);
 		glBindTexture(GL_TEXTURE_2D, t->id);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, t->texW, t->texH, _formats[_fmt].format, _formats[_fmt].type, texData);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, t->texW, t->texH, _formats[fmt].format, _formats[fmt].type, texData);
 		free(texData);
 	}
 }
@@ -321,19 +607,180 @@ void TextureCache::convertPalette(const uint8_t *src, uint16_t *dst) {
 
 void TextureCache::setPalette(const uint8_t *pal, bool updateTextures) {
 	convertPalette(pal, _clut);
+#ifndef USE_GLES
+	if (_gpuPalette) {
+		uint8_t lut[256 * 4];
+		for (int i = 0; i < 256; ++i) {
+			lut[i * 4]     = pal[i * 3];
+			lut[i * 4 + 1] = pal[i * 3 + 1];
+			lut[i * 4 + 2] = pal[i * 3 + 2];
+			lut[i * 4 + 3] = (i == 0 && _clut[0] == 0) ? 0 : 255;
+		}
+		_glActiveTexture(GL_TEXTURE1);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE, lut);
+		_glActiveTexture(GL_TEXTURE0);
+	}
+#endif
 	if (updateTextures) {
+		Texture *textures[kConvertJobsCount];
+		int count = 0;
 		for (Texture *t = _texturesListHead; t; t = t->next) {
-			if (!t->bitmapData) {
-				// skip rgb textures
+			if (!t->bitmapData || t->indexed) {
+				// skip rgb and palette indexes textures
 				continue;
 			}
-			uint16_t *texData = (uint16_t *)calloc(t->texW * t->texH, sizeof(uint16_t));
-			if (texData) {
-				convertTexture(t->bitmapData, t->bitmapW, t->bitmapH, _clut, texData, t->texW);
-				glBindTexture(GL_TEXTURE_2D, t->id);
-				glTexImage2D(GL_TEXTURE_2D, 0, _formats[_fmt].internal, t->texW, t->texH, 0, _formats[_fmt].format, _formats[_fmt].type, texData);
-				free(texData);
+			textures[count++] = t;
+			if (count == kConvertJobsCount) {
+				convertTextures(textures, count);
+				count = 0;
 			}
 		}
+		convertTextures(textures, count);
+	}
+}
+
+void TextureCache::bindTexture(const Texture *t) {
+	glBindTexture(GL_TEXTURE_2D, t->id);
+#ifndef USE_GLES
+	if (t->indexed) {
+		const Texture *page = t->atlas ? t->atlas : t;
+		_glUseProgram(_paletteProgram);
+		_glUniform2f(_texSizeLoc, page->texW, page->texH);
+		_glUniform1i(_fogLoc, glIsEnabled(GL_FOG));
+	}
+#endif
+}
+
+void TextureCache::unbindTexture(const Texture *t) {
+#ifndef USE_GLES
+	if (t->indexed) {
+		_glUseProgram(0);
+	}
+#endif
+}
+
+void TextureCache::beginAtlas() {
+	_atlasPendingCount = 0;
+}
+
+void TextureCache::addToAtlas(int16_t key, const uint8_t *data, int w, int h) {
+	if (hasTexture(key)) {
+		return;
+	}
+	for (int i = 0; i < _atlasPendingCount; ++i) {
+		if (_atlasPending[i]->key == key) {
+			return;
+		}
+	}
+	const int factor = _scalers[_scaler].factor;
+	// one pixel border on each side, replicating the edges for linear filtering
+	if ((w * factor + 2) > kTextureAtlasSize || (h * factor + 2) > kTextureAtlasSize) {
+		return;
+	}
+	if (_atlasPendingCount == _atlasPendingSize) {
+		const int size = _atlasPendingSize + 64;
+		Texture **p = (Texture **)realloc(_atlasPending, size * sizeof(Texture *));
+		if (!p) {
+			return;
+		}
+		_atlasPending = p;
+		_atlasPendingSize = size;
+	}
+	Texture *t = new Texture;
+	memset(t, 0, sizeof(Texture));
+	t->bitmapW = w;
+	t->bitmapH = h;
+	t->bitmapData = (uint8_t *)malloc(w * h);
+	if (!t->bitmapData) {
+		delete t;
+		return;
+	}
+	memcpy(t->bitmapData, data, w * h);
+	t->texW = w * factor;
+	t->texH = h * factor;
+	t->key = key;
+	t->pinned = true;
+	t->indexed = _gpuPalette;
+	_atlasPending[_atlasPendingCount++] = t;
+}
+
+void TextureCache::endAtlas() {
+	TraceZone zone("TextureCache::endAtlas");
+	int maxSize = kTextureAtlasSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	const int pageSize = MIN<int>(maxSize, kTextureAtlasSize);
+	int first = 0;
+	while (first < _atlasPendingCount) {
+		// shelf packing
+		int x = 0, y = 0, rowH = 0;
+		int last = first;
+		for (; last < _atlasPendingCount; ++last) {
+			Texture *t = _atlasPending[last];
+			const int w = t->texW + 2;
+			const int h = t->texH + 2;
+			if (x + w > pageSize) {
+				x = 0;
+				y += rowH;
+				rowH = 0;
+			}
+			if (y + h > pageSize) {
+				break;
+			}
+			t->atlasX = x;
+			t->atlasY = y;
+			x += w;
+			rowH = MAX(rowH, h);
+		}
+		if (last == first) {
+			break;
+		}
+		const int pageH = _npotTex ? (y + rowH) : roundPow2(y + rowH);
+		Texture *page = new Texture;
+		memset(page, 0, sizeof(Texture));
+		page->texW = pageSize;
+		page->texH = pageH;
+		page->u = page->v = 1.;
+		page->key = -1;
+		page->pinned = true;
+		page->indexed = _gpuPalette;
+		page->memSize = page->texW * page->texH * (page->indexed ? 1 : 2);
+		const int fmt = textureFormat(page);
+		const int filter = page->indexed ? GL_NEAREST : _filter;
+		glGenTextures(1, &page->id);
+		uint16_t *texData = (uint16_t *)calloc(page->texW * page->texH, sizeof(uint16_t));
+		glBindTexture(GL_TEXTURE_2D, page->id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, _formats[fmt].internal, page->texW, page->texH, 0, _formats[fmt].format, _formats[fmt].type, texData);
+		free(texData);
+		linkTextureHead(page, &_texturesListHead, &_texturesListTail);
+		++_stats.texturesCount;
+		_stats.memSize += page->memSize;
+		for (int i = first; i < last; ++i) {
+			Texture *t = _atlasPending[i];
+			t->id = page->id;
+			t->atlas = page;
+			t->u0 = (t->atlasX + 1) / (float)page->texW;
+			t->v0 = (t->atlasY + 1) / (float)page->texH;
+			t->u = t->texW / (float)page->texW;
+			t->v = t->texH / (float)page->texH;
+			linkTextureHead(t, &_texturesListHead, &_texturesListTail);
+			const int index = hashKey(t->key);
+			t->hashNext = _texturesHash[index];
+			_texturesHash[index] = t;
+			++_stats.texturesCount;
+		}
+		convertTextures(_atlasPending + first, last - first);
+		debug(kDebug_RENDER, "TextureCache::endAtlas() page %d,%d textures %d", page->texW, page->texH, last - first);
+		first = last;
+	}
+	for (int i = first; i < _atlasPendingCount; ++i) {
+		free(_atlasPending[i]->bitmapData);
+		delete _atlasPending[i];
 	}
+	_atlasPendingCount = 0;
 }
@@ -14,8 +14,26 @@ struct Texture {
 	uint8_t *bitmapData;
 	int texW, texH;
 	float u, v;
-	Texture *next;
+	float u0, v0; // sub-rectangle origin, non zero for atlas textures
+	Texture *atlas; // texture page holding the GL object
+	int atlasX, atlasY;
+	Texture *prev, *next; // LRU list, most recently used first
+	Texture *hashNext;
 	int16_t key;
+	bool pinned;
+	bool indexed; // 8 bits palette indexes, colors are looked up by the palette shader
+	int memSize;
+};
+
+struct TextureCacheStats {
+	int hits, misses, evictions;
+	int texturesCount;
+	int memSize;
+};
+
+enum {
+	kTextureHashSize = 512,
+	kTextureAtlasSize = 1024
 };
 
 struct TextureCache {
@@ -23,16 +41,26 @@ struct TextureCache {
 	TextureCache();
 	~TextureCache();
 
-	void init(const char *filter, const char *scaler);
+	void init(const char *filter, const char *scaler, int memSizeMax = 0, bool gpuPalette = false);
+	bool initPaletteShader();
 	void flush();
 
 	bool hasTexture(int16_t key) const;
 	void releaseTexture(int16_t key);
+	void pinTexture(int16_t key);
+	Texture *findTexture(int16_t key) const;
 	Texture *getCachedTexture(int16_t key, const uint8_t *data, int w, int h, bool rgb = false, const uint8_t *pal = 0);
 	void convertTexture(const uint8_t *src, int w, int h, const uint16_t *clut, uint16_t *dst, int dstPitch);
+	void convertTextures(Texture **textures, int count);
 	Texture *createTexture(const uint8_t *data, int w, int h, bool rgb = false, const uint8_t *pal = 0);
 	void destroyTexture(Texture *);
+	void evictTextures(const Texture *keep);
+	void beginAtlas();
+	void addToAtlas(int16_t key, const uint8_t *data, int w, int h);
+	void endAtlas();
 	void updateTexture(Texture *, const uint8_t *data, int w, int h, bool rgb = false, const uint8_t *pal = 0);
+	void bindTexture(const Texture *);
+	void unbindTexture(const Texture *);
 
 	void convertPalette(const uint8_t *src, uint16_t *dst);
 	void setPalette(const uint8_t *pal, bool updateTextures = true);
@@ -40,7 +68,18 @@ struct TextureCache {
 	int _filter;
 	int _scaler;
 	Texture *_texturesListHead, *_texturesListTail;
+	Texture *_texturesHash[kTextureHashSize];
+	int _memSizeMax;
+	bool _deferEviction; // textures referenced by pending draws must not be deleted
+	TextureCacheStats _stats;
+	Texture **_atlasPending;
+	int _atlasPendingCount, _atlasPendingSize;
 	uint16_t _clut[256];
+	uint16_t _indexClut[256];
+	bool _gpuPalette;
+	GLuint _lutTex;
+	GLuint _paletteProgram;
+	int _texSizeLoc, _linearFilterLoc, _fogLoc;
 	uint16_t *_texBuf;
 	bool _npotTex;
 };
@@ -0,0 +1,86 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <SDL.h>
+#include "benchmark.h"
+#include "trace.h"
+
+enum {
+	kTraceEventsMax = 1 << 20
+};
+
+struct TraceEvent {
+	const char *name;
+	uint64_t ts;
+	uint32_t tid;
+	char phase;
+	uint8_t ready;
+};
+
+bool g_traceEnabled;
+
+static TraceEvent *_traceEvents;
+static int _traceEventsCount;
+static uint64_t _traceStartTime;
+static char *_traceFilePath;
+
+void traceInit(const char *filePath) {
+	_traceEvents = (TraceEvent *)calloc(kTraceEventsMax, sizeof(TraceEvent));
+	if (!_traceEvents) {
+		warning("Unable to allocate %d trace events", kTraceEventsMax);
+		return;
+	}
+	_traceFilePath = strdup(filePath);
+	_traceEventsCount = 0;
+	_traceStartTime = getTimeMicros();
+	g_traceEnabled = true;
+}
+
+// called from the game, audio and decoding threads, no lock nor allocation
+void traceEvent(const char *name, char phase) {
+	const int index = __atomic_fetch_add(&_traceEventsCount, 1, __ATOMIC_RELAXED);
+	if (index >= kTraceEventsMax) {
+		return;
+	}
+	TraceEvent *e = &_traceEvents[index];
+	e->name = name;
+	e->ts = getTimeMicros() - _traceStartTime;
+	e->tid = (uint32_t)SDL_ThreadID();
+	e->phase = phase;
+	__atomic_store_n(&e->ready, 1, __ATOMIC_RELEASE);
+}
+
+// the other threads must be stopped
+void traceFini() {
+	if (!_traceEvents) {
+		return;
+	}
+	g_traceEnabled = false;
+	const int count = __atomic_load_n(&_traceEventsCount, __ATOMIC_ACQUIRE);
+	if (count > kTraceEventsMax) {
+		warning("Trace buffer full, %d events dropped", count - kTraceEventsMax);
+	}
+	FILE *fp = fopen(_traceFilePath, "w");
+	if (!fp) {
+		warning("Unable to open '%s' for writing", _traceFilePath);
+	} else {
+		fprintf(fp, "{\"traceEvents\":[\n");
+		bool first = true;
+		for (int i = 0; i < MIN(count, (int)kTraceEventsMax); ++i) {
+			const TraceEvent *e = &_traceEvents[i];
+			if (!__atomic_load_n(&e->ready, __ATOMIC_ACQUIRE)) {
+				continue;
+			}
+			fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%u}", first ? "" : ",\n", e->name, e->phase, (unsigned long long)e->ts, e->tid);
+			first = false;
+		}
+		fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		fclose(fp);
+	}
+	free(_traceEvents);
+	_traceEvents = 0;
+	free(_traceFilePath);
+	_traceFilePath = 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef TRACE_H__
+#define TRACE_H__
+
+#include "util.h"
+
+extern bool g_traceEnabled;
+
+void traceInit(const char *filePath);
+void traceFini();
+// 'name' must be a string literal, events are written as Chrome trace JSON on traceFini()
+void traceEvent(const char *name, char phase);
+
+struct TraceZone {
+	const char *_name;
+
+	TraceZone(const char *name)
+		: _name(g_traceEnabled ? name : 0) {
+		if (_name) {
+			traceEvent(_name, 'B');
+		}
+	}
+	~TraceZone() {
+		if (_name) {
+			traceEvent(_name, 'E');
+		}
+	}
+};
+
+#endif // TRACE_H__
@@ -25,6 +25,7 @@ enum {
 	kDebug_SAVELOAD = 1 << 7,
 	kDebug_XMIDI    = 1 << 8,
 	kDebug_INSTALL  = 1 << 9,
+	kDebug_RENDER   = 1 << 10,
 };
 
 extern const char *g_caption;
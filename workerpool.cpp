@@ -0,0 +1,118 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <SDL.h>
+#include "workerpool.h"
+
+WorkerPool g_workerPool;
+
+WorkerPool::WorkerPool()
+	: _threadsCount(0), _mutex(0), _jobCond(0), _doneCond(0), _proc(0), _data(0), _jobsCount(0), _nextJob(0), _doneJobs(0), _quit(false) {
+}
+
+WorkerPool::~WorkerPool() {
+	fini();
+}
+
+void WorkerPool::init(int threadsCount) {
+	if (threadsCount < 0) {
+		// the calling thread also runs jobs
+		threadsCount = SDL_GetCPUCount() - 1;
+	}
+	threadsCount = CLIP(threadsCount, 0, (int)kWorkerThreadsMax);
+	_mutex = SDL_CreateMutex();
+	_jobCond = SDL_CreateCond();
+	_doneCond = SDL_CreateCond();
+	if (!_mutex || !_jobCond || !_doneCond) {
+		warning("WorkerPool::init() unable to create synchronization objects");
+		return;
+	}
+	_quit = false;
+	for (int i = 0; i < threadsCount; ++i) {
+		_threads[_threadsCount] = SDL_CreateThread(threadProc, "worker", this);
+		if (!_threads[_threadsCount]) {
+			warning("WorkerPool::init() unable to create thread %d", i);
+			break;
+		}
+		++_threadsCount;
+	}
+	debug(kDebug_INFO, "Using %d worker threads", _threadsCount);
+}
+
+void WorkerPool::fini() {
+	if (_mutex) {
+		SDL_LockMutex(_mutex);
+		_quit = true;
+		SDL_CondBroadcast(_jobCond);
+		SDL_UnlockMutex(_mutex);
+	}
+	for (int i = 0; i < _threadsCount; ++i) {
+		SDL_WaitThread(_threads[i], 0);
+	}
+	_threadsCount = 0;
+	if (_doneCond) {
+		SDL_DestroyCond(_doneCond);
+		_doneCond = 0;
+	}
+	if (_jobCond) {
+		SDL_DestroyCond(_jobCond);
+		_jobCond = 0;
+	}
+	if (_mutex) {
+		SDL_DestroyMutex(_mutex);
+		_mutex = 0;
+	}
+}
+
+// called with the mutex locked
+bool WorkerPool::runNextJob() {
+	if (_nextJob >= _jobsCount) {
+		return false;
+	}
+	const int index = _nextJob++;
+	SDL_UnlockMutex(_mutex);
+	_proc(_data, index);
+	SDL_LockMutex(_mutex);
+	++_doneJobs;
+	if (_doneJobs == _jobsCount) {
+		SDL_CondSignal(_doneCond);
+	}
+	return true;
+}
+
+void WorkerPool::run(JobProc proc, void *data, int count) {
+	if (_threadsCount == 0 || count <= 1) {
+		for (int i = 0; i < count; ++i) {
+			proc(data, i);
+		}
+		return;
+	}
+	SDL_LockMutex(_mutex);
+	_proc = proc;
+	_data = data;
+	_jobsCount = count;
+	_nextJob = 0;
+	_doneJobs = 0;
+	SDL_CondBroadcast(_jobCond);
+	while (runNextJob()) {
+	}
+	while (_doneJobs < _jobsCount) {
+		SDL_CondWait(_doneCond, _mutex);
+	}
+	_jobsCount = 0;
+	SDL_UnlockMutex(_mutex);
+}
+
+int WorkerPool::threadProc(void *data) {
+	WorkerPool *pool = (WorkerPool *)data;
+	SDL_LockMutex(pool->_mutex);
+	while (!pool->_quit) {
+		if (!pool->runNextJob()) {
+			SDL_CondWait(pool->_jobCond, pool->_mutex);
+		}
+	}
+	SDL_UnlockMutex(pool->_mutex);
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * Fade To Black engine rewrite
+ * Copyright (C) 2006-2012 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef WORKERPOOL_H__
+#define WORKERPOOL_H__
+
+#include "util.h"
+
+struct SDL_Thread;
+struct SDL_mutex;
+struct SDL_cond;
+
+enum {
+	kWorkerThreadsMax = 8
+};
+
+struct WorkerPool {
+	typedef void (*JobProc)(void *data, int index);
+
+	WorkerPool();
+	~WorkerPool();
+
+	void init(int threadsCount = -1);
+	void fini();
+
+	// calls proc for each index in [0,count[ and returns when all jobs are done
+	void run(JobProc proc, void *data, int count);
+
+	bool runNextJob();
+	static int threadProc(void *data);
+
+	SDL_Thread *_threads[kWorkerThreadsMax];
+	int _threadsCount;
+	SDL_mutex *_mutex;
+	SDL_cond *_jobCond, *_doneCond;
+	JobProc _proc;
+	void *_data;
+	int _jobsCount;
+	int _nextJob;
+	int _doneJobs;
+	bool _quit;
+};
+
+extern WorkerPool g_workerPool;
+
+#endif // WORKERPOOL_H__